@@ -0,0 +1,39 @@
+#!/bin/sh
+# Measure how long 10cc takes to compile a synthetic program.
+#
+# Usage:
+#   $ bench/bench.sh [compiler] [n] [mode]   # Compile `gen <mode> n` five times and report the best wall time.
+#
+# mode is funcs (the default), macros, which measures macro expansion, conds, which measures skipping the groups of
+# false conditions, decls, which compiles a header of n groups of declarations, or pch, which compiles a file that
+# includes the same header through a precompiled one.
+set -e
+
+CC10=${1:-bld/10cc}
+N=${2:-20000}
+MODE=${3:-funcs}
+RUNS=5
+
+mkdir -p bld/bench
+${CC:-cc} -O2 -o bld/bench/gen bench/gen.c
+ARGS=
+if [ "$MODE" = pch ]; then
+    bld/bench/gen decls "$N" > bld/bench/decls.h
+    "$CC10" --emit-pch bld/bench/decls.pch bld/bench/decls.h
+    printf '#include "decls.h"\nint main() { return RECORD_1_SIZE; }\n' > bld/bench/pch.c
+    ARGS="--include-pch bld/bench/decls.pch"
+else
+    bld/bench/gen "$MODE" "$N" > bld/bench/$MODE.c
+fi
+
+best=
+for i in $(seq $RUNS); do
+    start=$(date +%s%N)
+    "$CC10" $ARGS bld/bench/$MODE.c > /dev/null
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+        best=$ms
+    fi
+done
+echo "$MODE n=$N lines=$(wc -l < bld/bench/$MODE.c) best=${best}ms ($RUNS runs, $CC10)"
@@ -0,0 +1,253 @@
+/**
+ * Generate a synthetic C program that 10cc can compile.
+ *
+ * Usage:
+ *   $ gen funcs <n>    # n functions, each referring to globals, locals, and the previous function.
+ *   $ gen macros <n>   # n functions written with nested function-like macros, # and ##.
+ *   $ gen conds <n>    # n functions, each with three more definitions in false #if/#elif/#else groups.
+ *   $ gen decls <n>    # A header of n groups of declarations (struct, enum, typedef, prototype, global, macro).
+ *   $ gen exprs <n>    # n functions, each returning an expression nested 64 levels deep.
+ *   $ gen enums <n>    # n enumeration constants in enums of 1000, and a function for each enum that uses them.
+ *   $ gen strings <n>  # n functions, each returning a string literal of about 240 characters with escapes.
+ *   $ gen blocks <n>   # n functions, each with blocks nested 32 levels deep that declare locals.
+ *   $ gen structs <n>  # n struct members in structs of 500, and a function for each struct that accesses them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Emit function i, which refers to a pool of ngvars global variables and function i - 1.
+void gen_func(int i, int ngvars) {
+    printf("int function_number_%d(int argument_a, int argument_b) {\n", i);
+    printf("    int local_total = argument_a + argument_b * 2;\n");
+    printf("    int local_index = 0;\n");
+    printf("    for (int loop_index = 0; loop_index < 4; loop_index++) {\n");
+    printf("        local_total = local_total + loop_index * global_counter_%d;\n", i % ngvars);
+    printf("        local_index += 1;\n");
+    printf("    }\n");
+    printf("    if (local_total > %d) {\n", i);
+    printf("        global_counter_%d = local_total - local_index;\n", (i * 7) % ngvars);
+    printf("    }\n");
+    if (i > 0) {
+        printf("    return function_number_%d(local_total, local_index) + local_total;\n", i - 1);
+    } else {
+        printf("    return local_total;\n");
+    }
+    printf("}\n");
+}
+
+// Emit n functions that share a pool of global variables.
+void gen_funcs(int n) {
+    int ngvars = n / 10 + 1;
+    for (int i = 0; i < ngvars; i++) {
+        printf("int global_counter_%d;\n", i);
+    }
+    printf("\n");
+    for (int i = 0; i < n; i++) {
+        gen_func(i, ngvars);
+        printf("\n");
+    }
+}
+
+// Emit the functions of gen_funcs(), each in a platform-conditional block where only the first group is true.
+void gen_conds(int n) {
+    int ngvars = n / 10 + 1;
+    printf("#define PLATFORM_LINUX 1\n\n");
+    for (int i = 0; i < ngvars; i++) {
+        printf("int global_counter_%d;\n", i);
+    }
+    printf("\n");
+    for (int i = 0; i < n; i++) {
+        printf("#if defined(PLATFORM_LINUX) && PLATFORM_LINUX >= 1\n");
+        gen_func(i, ngvars);
+        printf("#elif defined(PLATFORM_WINDOWS)\n");
+        gen_func(i, ngvars);
+        printf("#elif defined(PLATFORM_DARWIN)\n");
+        printf("#  ifdef PLATFORM_DARWIN_ARM64\n");
+        gen_func(i, ngvars);
+        printf("#  endif\n");
+        printf("#else\n");
+        printf("#  error \"unsupported platform\"\n");
+        gen_func(i, ngvars);
+        printf("#endif\n\n");
+    }
+}
+
+// Emit n functions whose bodies are mostly macro invocations.
+void gen_macros(int n) {
+    int ngvars = n / 10 + 1;
+    for (int i = 0; i < ngvars; i++) {
+        printf("int global_counter_%d;\n", i);
+    }
+    printf("\n");
+    printf("#define ADD(a, b) ((a) + (b))\n");
+    printf("#define MUL(a, b) ((a) * (b))\n");
+    printf("#define SQUARE(x) MUL(x, x)\n");
+    printf("#define CAT(a, b) a##b\n");
+    printf("#define GLOBAL(i) CAT(global_counter_, i)\n");
+    printf("#define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))\n");
+    printf("#define STEP(t, i) t = ADD(t, MUL(i, SQUARE(i)))\n");
+    printf("#define NAME(s) #s\n");
+    printf("#define LIMIT 1000\n");
+    printf("\n");
+    for (int i = 0; i < n; i++) {
+        printf("int function_number_%d(int argument_a, int argument_b) {\n", i);
+        printf("    int local_total = ADD(argument_a, MUL(argument_b, 2));\n");
+        printf("    char *local_name = NAME(function_number_%d);\n", i);
+        printf("    for (int loop_index = 0; loop_index < 4; loop_index++) {\n");
+        printf("        STEP(local_total, loop_index);\n");
+        printf("        local_total = CLAMP(local_total, 0, LIMIT) + GLOBAL(%d);\n", i % ngvars);
+        printf("    }\n");
+        printf("    GLOBAL(%d) = SQUARE(ADD(local_total, local_name[0]));\n", (i * 7) % ngvars);
+        if (i > 0) {
+            printf("    return function_number_%d(local_total, CLAMP(argument_a, 0, LIMIT));\n", i - 1);
+        } else {
+            printf("    return local_total;\n");
+        }
+        printf("}\n\n");
+    }
+}
+
+// Emit a header of n groups of declarations, as the prologue that generated files share.
+void gen_decls(int n) {
+    printf("#ifndef DECLS_H\n#define DECLS_H\n\n");
+    for (int i = 0; i < n; i++) {
+        printf("struct record_%d {\n", i);
+        printf("    int record_id;\n");
+        printf("    char record_name[16];\n");
+        if (i > 0) {
+            printf("    struct record_%d *previous;\n", i - 1);
+        }
+        printf("};\n");
+        printf("enum state_%d { STATE_%d_IDLE, STATE_%d_BUSY = %d, STATE_%d_DONE };\n", i, i, i, i + 2, i);
+        printf("typedef struct record_%d record_t_%d;\n", i, i);
+        printf("int process_record_%d(record_t_%d *record, int flags);\n", i, i);
+        printf("record_t_%d record_table_%d[4];\n", i, i);
+        printf("#define RECORD_%d_SIZE %d\n\n", i, i * 8);
+    }
+    printf("#endif\n");
+}
+
+// Emit n functions that each return a parenthesized expression nested depth levels deep.
+void gen_exprs(int n) {
+    int depth = 64;
+    char *ops[] = {"+", "-", "*", "/", "<", "<=", "==", "!=", ">", ">="};
+    for (int i = 0; i < n; i++) {
+        printf("int expression_%d(int x, int y) {\n    return ", i);
+        for (int d = 0; d < depth; d++) {
+            printf(d % 8 == 7 ? "(x > %d ? " : "(", d);
+        }
+        printf("x");
+        for (int d = depth - 1; d >= 0; d--) {
+            if (d % 8 == 7) {
+                printf(" : y)");
+            } else {
+                printf(" %s %s)", ops[(i + d) % 10], d % 3 ? "y" : "3");
+            }
+        }
+        printf(";\n}\n\n");
+    }
+}
+
+// Emit n enumeration constants in enums of up to 1000 constants, each followed by a function that uses some of them.
+void gen_enums(int n) {
+    for (int e = 0; e * 1000 < n; e++) {
+        int len = n - e * 1000 < 1000 ? n - e * 1000 : 1000;
+        printf("enum opcode_%d {\n", e);
+        for (int i = 0; i < len; i++) {
+            if (i % 10 == 0) {
+                printf("    OPCODE_%d_%d = %d,\n", e, i, i * 3);
+            } else {
+                printf("    OPCODE_%d_%d,\n", e, i);
+            }
+        }
+        printf("};\n\n");
+        printf("int opcode_class_%d(int op) {\n", e);
+        for (int i = 0; i < len; i += 50) {
+            printf("    if (op == OPCODE_%d_%d) {\n        return %d;\n    }\n", e, len - 1 - i, i);
+        }
+        printf("    return -1;\n}\n\n");
+    }
+}
+
+// Emit n functions that each return a long string literal.
+void gen_strings(int n) {
+    for (int i = 0; i < n; i++) {
+        printf("char *message_%d() {\n    return \"", i);
+        for (int j = 0; j < 4; j++) {
+            printf("message %d part %d: the quick brown fox jumps over the lazy dog\\t\\\"%d\\\"\\n", i, j, j);
+        }
+        printf("\";\n}\n\n");
+    }
+}
+
+// Emit n functions that each nest depth blocks, declaring a local in every block.
+void gen_blocks(int n) {
+    int depth = 32;
+    for (int i = 0; i < n; i++) {
+        printf("int nested_%d(int x) {\n", i);
+        printf("    int total = 0;\n");
+        for (int d = 0; d < depth; d++) {
+            printf("%*sif (x > %d) {\n", 4 * (d + 1), "", d);
+            printf("%*sint level_%d = x - %d;\n", 4 * (d + 2), "", d, d);
+            printf("%*stotal = total + level_%d;\n", 4 * (d + 2), "", d);
+        }
+        for (int d = depth - 1; d >= 0; d--) {
+            printf("%*s}\n", 4 * (d + 1), "");
+        }
+        printf("    return total;\n}\n\n");
+    }
+}
+
+// Emit n struct members in structs of up to 500 members, each followed by a function that accesses the members.
+void gen_structs(int n) {
+    for (int s = 0; s * 500 < n; s++) {
+        int len = n - s * 500 < 500 ? n - s * 500 : 500;
+        printf("struct table_%d {\n", s);
+        for (int i = 0; i < len; i++) {
+            printf(i % 3 ? "    int field_%d;\n" : i % 2 ? "    long field_%d;\n" : "    char field_%d[12];\n", i);
+        }
+        printf("};\n\n");
+        printf("struct table_%d table_%d;\n\n", s, s);
+        printf("int table_sum_%d() {\n", s);
+        printf("    struct table_%d *t = &table_%d;\n", s, s);
+        printf("    int sum = 0;\n");
+        for (int i = len - 1; i >= 0; i -= 5) {
+            if (i % 6) {  // Not an array
+                printf("    sum = sum + t->field_%d;\n", i);
+            }
+        }
+        printf("    return sum;\n}\n\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s funcs|macros|conds|decls|exprs|enums|strings|blocks|structs <n>\n", argv[0]);
+        return 1;
+    }
+    int n = atoi(argv[2]);
+    if (!strcmp(argv[1], "funcs")) {
+        gen_funcs(n);
+    } else if (!strcmp(argv[1], "macros")) {
+        gen_macros(n);
+    } else if (!strcmp(argv[1], "conds")) {
+        gen_conds(n);
+    } else if (!strcmp(argv[1], "decls")) {
+        gen_decls(n);
+    } else if (!strcmp(argv[1], "exprs")) {
+        gen_exprs(n);
+    } else if (!strcmp(argv[1], "enums")) {
+        gen_enums(n);
+    } else if (!strcmp(argv[1], "strings")) {
+        gen_strings(n);
+    } else if (!strcmp(argv[1], "blocks")) {
+        gen_blocks(n);
+    } else if (!strcmp(argv[1], "structs")) {
+        gen_structs(n);
+    } else {
+        fprintf(stderr, "unknown mode: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
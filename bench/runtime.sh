@@ -0,0 +1,90 @@
+#!/bin/sh
+# Measure how fast the code that 10cc generates runs, compared with gcc at several optimization levels.
+#
+# Usage:
+#   $ bench/runtime.sh [compiler]   # Build and run bench/runtime/*.c, and write bld/bench/runtime.tsv.
+#
+# Each program is built with 10cc and with $CC at each of LEVELS, and the outputs of all the builds must agree. Each
+# build runs RUNS times, and the best wall time is reported along with its ratio to each gcc build. When `perf stat`
+# works, the cycles and instructions of one more run are recorded as well.
+set -e
+
+CC10=${1:-bld/10cc}
+CC=${CC:-cc}
+LEVELS=${LEVELS:-"-O0 -O1 -O2"}
+RUNS=${RUNS:-5}
+OUT=bld/bench/runtime
+RESULTS=bld/bench/runtime.tsv
+
+mkdir -p $OUT
+use_perf=
+if command -v perf > /dev/null 2>&1 && perf stat -x, -e cycles,instructions true > /dev/null 2>&1; then
+    use_perf=1
+fi
+
+# Print the best wall time of RUNS runs of a program in milliseconds.
+best_ms() {
+    best=
+    for i in $(seq $RUNS); do
+        start=$(date +%s%N)
+        "$1" > /dev/null
+        end=$(date +%s%N)
+        us=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ "$us" -lt "$best" ]; then
+            best=$us
+        fi
+    done
+    awk -v us="$best" 'BEGIN { printf "%.1f", us / 1000 }'
+}
+
+# Print the cycles and instructions of a run of a program separated by a tab, or "-" for each without perf.
+counters() {
+    if [ -z "$use_perf" ]; then
+        printf -- '-\t-'
+        return
+    fi
+    perf stat -x, -e cycles,instructions -o $OUT/perf.txt "$1" > /dev/null
+    awk -F, '$3 == "cycles" || $3 ~ /^cycles:/ { c = $1 } $3 == "instructions" || $3 ~ /^instructions:/ { i = $1 }
+             END { printf "%s\t%s", c == "" ? "-" : c, i == "" ? "-" : i }' $OUT/perf.txt
+}
+
+printf 'program\tbuild\tbest_ms\tcycles\tinstructions\n' > $RESULTS
+for src in bench/runtime/*.c; do
+    prog=$(basename $src .c)
+    "$CC10" -o $OUT/$prog.s $src
+    $CC -static -Wl,-z,noexecstack -o $OUT/$prog.10cc $OUT/$prog.s
+    builds=10cc
+    for level in $LEVELS; do
+        $CC -std=c11 -w -static $level -o $OUT/$prog$level $src
+        builds="$builds $prog$level"
+    done
+
+    expected=$($OUT/$prog.10cc)
+    for level in $LEVELS; do
+        if [ "$($OUT/$prog$level)" != "$expected" ]; then
+            echo "$prog: the output of 10cc differs from $CC $level" >&2
+            exit 1
+        fi
+    done
+
+    printf '%s\t10cc\t%s\t%s\n' $prog "$(best_ms $OUT/$prog.10cc)" "$(counters $OUT/$prog.10cc)" >> $RESULTS
+    for level in $LEVELS; do
+        printf '%s\t%s\t%s\t%s\n' $prog "$CC $level" "$(best_ms $OUT/$prog$level)" "$(counters $OUT/$prog$level)" \
+            >> $RESULTS
+    done
+done
+
+# Show the time of each build and how many times slower 10cc is than each of the others.
+awk -F'\t' '
+    NR == 1 { next }
+    $2 == "10cc" {
+        if (prog != "") print line
+        prog = $1
+        base = $3
+        line = sprintf("%-10s 10cc %8.1f ms", $1, $3)
+        if ($5 != "-") line = line sprintf(" (%.2f IPC)", $5 / $4)
+        next
+    }
+    { line = line sprintf("  %s %7.1f ms x%.2f", $2, $3, base / $3) }
+    END { print line }' $RESULTS
+echo "results: $RESULTS (best of $RUNS runs$([ -n "$use_perf" ] && echo ', perf stat counters'))"
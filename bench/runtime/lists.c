@@ -0,0 +1,60 @@
+// Linked lists of structs, which measures pointer chasing, member access, and allocation.
+int printf();
+void *calloc();
+
+struct Item {
+    int key;
+    int value;
+    int flags;
+    void *next;  // struct Item *, which 10cc cannot declare inside struct Item
+};
+
+// Build a list of n items, most recent first.
+struct Item *build(int n) {
+    struct Item *head = 0;
+    for (int i = 0; i < n; i++) {
+        struct Item *item = calloc(1, sizeof(struct Item));
+        item->key = i;
+        item->value = i * 3 + 1;
+        item->flags = i - i / 4 * 4;
+        item->next = head;
+        head = item;
+    }
+    return head;
+}
+
+// Reverse a list in place.
+struct Item *reverse(struct Item *head) {
+    struct Item *prev = 0;
+    while (head) {
+        struct Item *next = head->next;
+        head->next = prev;
+        prev = head;
+        head = next;
+    }
+    return prev;
+}
+
+// Return a weighted sum of the values of the items with a given flag.
+long sum(struct Item *head, int flag) {
+    long total = 0;
+    int index = 0;
+    for (struct Item *item = head; item; item = item->next) {
+        if (item->flags == flag) {
+            total = total + item->value * (index - index / 7 * 7);
+        }
+        index++;
+    }
+    return total;
+}
+
+int main() {
+    struct Item *head = build(1000000);
+    long checksum = 0;
+    for (int round = 0; round < 20; round++) {
+        head = reverse(head);
+        checksum = checksum + sum(head, round - round / 4 * 4);
+    }
+    printf("%ld\n", checksum);
+    return 0;
+}
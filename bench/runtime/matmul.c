@@ -0,0 +1,33 @@
+// Matrix multiplication, which measures nested loops and two-dimensional array indexing.
+int printf();
+
+int a[256][256];
+int b[256][256];
+int c[256][256];
+
+int main() {
+    int n = 256;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[i][j] = i + j;
+            b[i][j] = i - j;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            int sum = 0;
+            for (int k = 0; k < n; k++) {
+                sum += a[i][k] * b[k][j];
+            }
+            c[i][j] = sum;
+        }
+    }
+    long checksum = 0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            checksum = checksum + c[i][j] / (i + 1) - j;
+        }
+    }
+    printf("%ld\n", checksum);
+    return 0;
+}
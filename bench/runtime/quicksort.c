@@ -0,0 +1,66 @@
+// Quicksort of pseudo-random integers, which measures recursion, comparisons, and swaps in an array.
+int printf();
+
+int values[1000000];
+int seed;
+
+// Return the next pseudo-random number in [0, 65536] of a linear congruential generator. Every intermediate value fits
+// in an int, as 10cc multiplies and divides only ints.
+int next_random() {
+    seed = seed * 75 + 74;
+    seed = seed - seed / 65537 * 65537;
+    return seed;
+}
+
+// Sort values[lo..hi] in place.
+void quicksort(int lo, int hi) {
+    while (lo < hi) {
+        int pivot = values[(lo + hi) / 2];
+        int i = lo;
+        int j = hi;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                int tmp = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        // Recurse into the smaller half to bound the depth.
+        if (j - lo < hi - i) {
+            quicksort(lo, j);
+            lo = i;
+        } else {
+            quicksort(i, hi);
+            hi = j;
+        }
+    }
+}
+
+int main() {
+    int n = 1000000;
+    seed = 42;
+    for (int i = 0; i < n; i++) {
+        values[i] = next_random() * 16384 + next_random() / 4;
+    }
+    quicksort(0, n - 1);
+    long checksum = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            if (values[i - 1] > values[i]) {
+                printf("not sorted at %d\n", i);
+                return 1;
+            }
+        }
+        checksum = checksum + values[i] / 1000 * (i - i / 1000 * 1000);
+    }
+    printf("%ld\n", checksum);
+    return 0;
+}
@@ -0,0 +1,30 @@
+// Sieve of Eratosthenes, which measures loops over a byte array.
+int printf();
+
+char composite[2000001];
+
+// Count the primes up to n.
+int sieve(int n) {
+    for (int i = 0; i <= n; i++) {
+        composite[i] = 0;
+    }
+    int count = 0;
+    for (int i = 2; i <= n; i++) {
+        if (composite[i] == 0) {
+            count++;
+            for (int j = i + i; j <= n; j += i) {
+                composite[j] = 1;
+            }
+        }
+    }
+    return count;
+}
+
+int main() {
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        count = sieve(2000000);
+    }
+    printf("%d\n", count);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Hashing of strings into a chained hash table, which measures byte loads, multiplication, and string comparison.
+int printf();
+void *calloc();
+
+struct Entry {
+    char *key;
+    int count;
+    void *next;  // struct Entry *, which 10cc cannot declare inside struct Entry
+};
+
+char text[4000000];     // Words of pseudo-random letters, each terminated by a NUL
+struct Entry *table[65536];
+int seed;
+
+// Return the next pseudo-random number in [0, 65536] of a linear congruential generator. Every intermediate value fits
+// in an int, as 10cc multiplies and divides only ints.
+int next_random() {
+    seed = seed * 75 + 74;
+    seed = seed - seed / 65537 * 65537;
+    return seed;
+}
+
+// Return the polynomial hash of a string modulo the size of the table.
+int hash(char *s) {
+    int h = 0;
+    for (; *s; s++) {
+        h = h * 31 + *s;
+        h = h - h / 1000003 * 1000003;
+    }
+    return h - h / 65536 * 65536;
+}
+
+// Return true if two strings are the same.
+int equal(char *a, char *b) {
+    for (; *a == *b; a++, b++) {
+        if (*a == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Count a word in the table, and return its entry.
+struct Entry *count(char *word) {
+    int h = hash(word);
+    for (struct Entry *e = table[h]; e; e = e->next) {
+        if (equal(e->key, word)) {
+            e->count++;
+            return e;
+        }
+    }
+    struct Entry *e = calloc(1, sizeof(struct Entry));
+    e->key = word;
+    e->count = 1;
+    e->next = table[h];
+    table[h] = e;
+    return e;
+}
+
+int main() {
+    seed = 7;
+    int len = 0;
+    int num_words = 0;
+    while (len < 4000000 - 16) {
+        int r = next_random();
+        int word_len = 3 + r - r / 6 * 6;
+        for (int i = 0; i < word_len; i++) {
+            r = next_random();
+            text[len++] = 97 + r - r / 6 * 6;
+        }
+        text[len++] = 0;
+        num_words++;
+    }
+
+    int distinct = 0;
+    long total = 0;
+    for (int round = 0; round < 2; round++) {
+        char *word = text;
+        for (int i = 0; i < num_words; i++) {
+            struct Entry *e = count(word);
+            distinct += e->count == 1;
+            total += e->count;
+            while (*word) {
+                word++;
+            }
+            word++;
+        }
+    }
+    printf("%d %d %ld\n", num_words, distinct, total);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Measure the compile throughput of 10cc over a suite of synthetic programs, and compare it with a baseline.
+#
+# Usage:
+#   $ bench/suite.sh [compiler] [baseline]   # Write bld/bench/results.tsv, and compare it with the baseline.
+#
+# Each program of the suite is compiled RUNS times with -ftime-report and -fmem-report, and the run with the least total
+# time is recorded as a line of tab-separated values. The baseline (bench/baseline.tsv by default) is a results file
+# of an earlier run; `make bench-baseline` replaces it with the results of the current tree. A program whose total
+# time exceeds the baseline by more than THRESHOLD percent is marked as slower.
+set -e
+
+CC10=${1:-bld/10cc}
+BASELINE=${2:-bench/baseline.tsv}
+RUNS=${RUNS:-5}
+THRESHOLD=${THRESHOLD:-10}
+RESULTS=bld/bench/results.tsv
+
+# Programs of the suite as <mode>:<n> of bench/gen.c.
+SUITE="funcs:20000 macros:10000 conds:10000 exprs:2000 enums:200000 strings:10000 blocks:1000 structs:200000"
+
+mkdir -p bld/bench
+${CC:-cc} -O2 -o bld/bench/gen bench/gen.c
+
+COLUMNS="mode	n	lines	tokens	nodes	tokens_per_s	peak_rss_kb	tokenize_ms	preprocess_ms	cache_ms	parse_ms	sema_ms	codegen_ms	total_ms"
+echo "$COLUMNS" > $RESULTS
+for prog in $SUITE; do
+    mode=${prog%:*}
+    n=${prog#*:}
+    src=bld/bench/$mode.c
+    bld/bench/gen "$mode" "$n" > $src
+    lines=$(wc -l < $src)
+    best=
+    for i in $(seq $RUNS); do
+        "$CC10" -ftime-report -fmem-report -o /dev/null $src 2> bld/bench/report.txt
+        row=$(awk -v mode="$mode" -v n="$n" -v lines="$lines" '
+            $1 == "tokenize" || $1 == "preprocess" || $1 == "cache" || $1 == "parse" || $1 == "sema" ||
+                $1 == "codegen" || $1 == "total" {
+                if (!($1 in ms)) ms[$1] = $2  # The memory report has a total line as well.
+            }
+            $1 == "tokens" { tokens = $2 }
+            $1 == "nodes" { nodes = $2 }
+            $1 == "peak" && $2 == "RSS" { rss = $4 }
+            END {
+                printf "%s\t%s\t%s\t%d\t%d\t%.0f\t%d", mode, n, lines, tokens, nodes, tokens / (ms["total"] / 1000), rss
+                printf "\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n", ms["tokenize"], ms["preprocess"], ms["cache"], ms["parse"],
+                    ms["sema"], ms["codegen"], ms["total"]
+            }' bld/bench/report.txt)
+        total=$(echo "$row" | cut -f14)
+        if [ -z "$best" ] || awk -v a="$total" -v b="$best_total" 'BEGIN { exit !(a < b) }'; then
+            best=$row
+            best_total=$total
+        fi
+    done
+    echo "$best" >> $RESULTS
+done
+echo "results: $RESULTS ($RUNS runs each, $CC10)"
+
+if [ ! -f "$BASELINE" ]; then
+    echo "no baseline: $BASELINE"
+    exit 0
+fi
+awk -F'\t' -v threshold="$THRESHOLD" '
+    FNR == 1 { next }
+    NR == FNR { base_ms[$1] = $14; base_tps[$1] = $6; base_rss[$1] = $7; next }
+    {
+        if (!($1 in base_ms)) {
+            printf "%-8s %10.1f ms  (not in the baseline)\n", $1, $14
+            next
+        }
+        ratio = $14 / base_ms[$1]
+        mark = ratio > 1 + threshold / 100 ? "  slower" : ratio < 1 - threshold / 100 ? "  faster" : ""
+        printf "%-8s %10.1f ms  baseline %10.1f ms  x%.2f  tokens/s x%.2f  peak RSS x%.2f%s\n", $1, $14, base_ms[$1],
+            ratio, $6 / base_tps[$1], $7 / base_rss[$1], mark
+    }' "$BASELINE" $RESULTS
@@ -1,7 +1,7 @@
 /**
  * How to build:
  *   $ make                                                # Build 10cc.
- *   $ ./bld/10cc examples/fibo.c > fibo.s                 # Compile fibo.c using 10cc.
+ *   $ ./bld/10cc -o fibo.s examples/fibo.c                # Compile fibo.c using 10cc.
  *   $ cc -std=c11 -static -c -o testkit.o test/testkit.c  # Compile test tools using *cc*.
  *   $ cc -std=c11 -g -static fibo.s testkit.o -o fibo     # Link them to create an executable file.
  *   $ ./fibo                                              # Run.
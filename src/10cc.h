@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -8,7 +10,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "tencc.h"
+
+typedef struct File File;
 typedef struct Token Token;
+typedef struct Group Group;
 typedef struct Type Type;
 typedef struct Node Node;
 typedef struct Var Var;
@@ -17,42 +23,160 @@ typedef struct Func Func;
 typedef struct Prog Prog;
 typedef struct Vector Vector;
 typedef struct Map Map;
-
-// main.c
-extern char *file_name;
-extern char *user_input;
+typedef struct Arena Arena;
+typedef struct ArenaChunk ArenaChunk;
+typedef struct Buffer Buffer;
+typedef struct Compiler Compiler;
+typedef struct FuncCacheEntry FuncCacheEntry;
+typedef struct FuncCache FuncCache;
+typedef struct Pch Pch;
+typedef struct VarScope VarScope;
+typedef struct TagScope TagScope;
+typedef struct Header Header;
+typedef struct FileStamp FileStamp;
+typedef struct Macro Macro;
+typedef struct HideSet HideSet;
 
 // tokenize.c
-extern Token *ctok;
-
 typedef enum {
     TK_RESERVED,  // '+', '-', and so on
     TK_IDENT,     // identifier
     TK_NUM,       // number
     TK_STR,       // string literal
-    TK_CHAR,      // char literal
     TK_EOF        // EOF
 } TokenKind;
 
+typedef enum {
+    // Keywords
+    KW_RETURN,
+    KW_IF,
+    KW_ELSE,
+    KW_WHILE,
+    KW_FOR,
+    KW_BREAK,
+    KW_CONTINUE,
+    KW_STRUCT,
+    KW_ENUM,
+    KW_TYPEDEF,
+    KW_SIZEOF,
+    KW_VOID,
+    KW_BOOL,
+    KW_CHAR,
+    KW_SHORT,
+    KW_INT,
+    KW_LONG,
+    // Punctuators
+    PU_LE,          // <=
+    PU_GE,          // >=
+    PU_EQ,          // ==
+    PU_NE,          // !=
+    PU_INC,         // ++
+    PU_DEC,         // --
+    PU_ADD_ASSIGN,  // +=
+    PU_SUB_ASSIGN,  // -=
+    PU_MUL_ASSIGN,  // *=
+    PU_DIV_ASSIGN,  // /=
+    PU_ARROW,       // ->
+    PU_PLUS,        // +
+    PU_MINUS,       // -
+    PU_STAR,        // *
+    PU_SLASH,       // /
+    PU_LPAREN,      // (
+    PU_RPAREN,      // )
+    PU_LT,          // <
+    PU_GT,          // >
+    PU_ASSIGN,      // =
+    PU_SEMICOLON,   // ;
+    PU_LBRACE,      // {
+    PU_RBRACE,      // }
+    PU_COMMA,       // ,
+    PU_LBRACKET,    // [
+    PU_RBRACKET,    // ]
+    PU_AMP,         // &
+    PU_DOT,         // .
+    PU_COLON,       // :
+    PU_NOT,         // !
+    PU_QUESTION,    // ?
+    PU_TILDE,       // ~
+    PU_HASH,        // #
+    PU_HASHHASH,    // ##
+    PU_MOD,         // %
+    PU_SHL,         // <<
+    PU_SHR,         // >>
+    PU_OR,          // |
+    PU_XOR,         // ^
+    PU_LOGAND,      // &&
+    PU_LOGOR,       // ||
+    NUM_RESERVED
+} ReservedId;  // Keywords and punctuators
+
 struct Token {
     TokenKind kind;
+    ReservedId id;  // TK_RESERVED
     Token *next;
-    bool is_bol;
-    char *str;
+    File *file;  // File that loc points into
+    char *str;   // Spelling for TK_RESERVED; interned spelling for TK_IDENT; contents for TK_STR
     char *loc;
     long val;
+    int line;  // 1-origin line number of loc
+    int col;   // 1-origin column number of loc
+    int len;   // Length of the spelling at loc
+    bool is_bol;
+    bool has_space;    // true if white space precedes the token
+    HideSet *hideset;  // Macros that must not be expanded at the token
+    union {
+        Macro *macro;  // "#" of #define in a header: memo of the macro that it defines, or NULL
+        Group *group;  // "#" of #if, #ifdef, #ifndef, #elif, or #else: the lines that it controls
+    };
+};
+
+// The lines that a conditional directive controls, up to the next #elif, #else, or #endif of the conditional. They are
+// tokenized only when the preprocessor includes them.
+struct Group {
+    File *file;
+    char *start;
+    char *end;      // "#" of the next directive of the conditional, or the end of the tokenized range
+    Arena *arena;   // Arena that the tokens are allocated from
+    Token *tokens;  // Tokens of the lines terminated by EOF, or NULL until they are tokenized
 };
 
-Token *tokenize();
+extern char *reserved_str[NUM_RESERVED];
+
+Token *tokenize(File *file, Arena *arena);
+Token *tokenize_range(File *file, char *p, char *end, Arena *arena);
 
-Token *peek(TokenKind kind, char *str);
-Token *consume(TokenKind kind, char *str);
-Token *expect(TokenKind kind, char *str);
+Token *peek(TokenKind kind);
+Token *consume(TokenKind kind);
+Token *expect(TokenKind kind);
+Token *peek_id(ReservedId id);
+Token *consume_id(ReservedId id);
+Token *expect_id(ReservedId id);
 
 bool at_eof();
 
 // preprocess.c
+// The identity of a file at some point, which changes when the file is modified
+struct FileStamp {
+    char *path;
+    long dev;
+    long ino;
+    long size;
+    long mtime_sec;
+    long mtime_nsec;
+    bool missing;  // true if no file was at the path when it was stamped
+};
+
+extern _Thread_local Arena header_arena;
+
 Token *preprocess(Token *tok);
+void dump_macros(Buffer *buf);
+char *resolve_path(char *name);
+bool stamp_file(char *path, FileStamp *stamp);
+FileStamp *included_files(int *num_files);
+FileStamp *dependencies(int *num_deps);
+bool is_file_changed(FileStamp *stamp);
+size_t header_cache_size();
+void release_headers();
 
 // parse.c
 typedef enum {
@@ -98,8 +222,14 @@ struct Func {
     char *name;
     Vector *lvars;   // Vector<Var *>
     Vector *params;  // Vector<Var *>
+    Vector *strs;    // Vector<Var *> of string literals
     Node *body;
     Token *tok;
+
+    // Per-function cache
+    uint64_t *key;     // 128-bit key of the definition, or NULL
+    char *code;        // Assembly code reused from the cache instead of body, or NULL
+    size_t code_size;  // Length of code
 };
 
 struct Node {
@@ -107,32 +237,50 @@ struct Node {
     Type *type;     // Type
     Token *tok;     // Representative token
 
-    Node *lhs;  // Left-hand side
-    Node *rhs;  // Right-hand side
-
-    // "if", "while", or "for" statement
-    Node *cond;
-    Node *then;
-    Node *els;
-    Node *init;
-    Node *upd;
-
-    // Block statement
-    Vector *stmts;
-
-    // Function call
-    char *func_name;
-    Vector *args;
-
-    // Variable reference
-    Var *var;
-
-    // Number literal
-    long val;
-
-    // Struct member
-    char *member_name;
-    Member *member;
+    // Kind-specific payload
+    union {
+        // Unary and binary operators, and struct member access
+        struct {
+            Node *lhs;  // Left-hand side
+            union {
+                Node *rhs;  // Right-hand side
+
+                // Struct member
+                struct {
+                    char *member_name;
+                    Member *member;
+                };
+            };
+        };
+
+        // "if", "while", or "for" statement, or conditional operator
+        struct {
+            Node *cond;
+            Node *then;
+            union {
+                Node *els;  // "if" and conditional operator
+                struct {    // "for"
+                    Node *init;
+                    Node *upd;
+                };
+            };
+        };
+
+        // Block statement
+        Vector *stmts;
+
+        // Function call
+        struct {
+            char *func_name;
+            Vector *args;
+        };
+
+        // Variable reference
+        Var *var;
+
+        // Number literal
+        long val;
+    };
 };
 
 struct Var {
@@ -153,7 +301,31 @@ struct Member {
     int offset;
 };
 
+// A binding of a name in the scope of variables, typedefs, and enum constants
+struct VarScope {
+    VarScope *next;  // The binding of the same name that this one shadows
+    char *name;
+    int depth;
+
+    Var *var;
+    Type *type_def;
+    Type *enum_type;
+    int enum_val;
+};
+
+// A binding of a struct or enum tag
+struct TagScope {
+    TagScope *next;  // The binding of the same name that this one shadows
+    char *name;
+    int depth;
+
+    Type *type;
+};
+
 Prog *parse();
+VarScope *push_var_scope(char *name);
+TagScope *push_tag_scope(char *name);
+uint64_t hash_decls(uint64_t h, Token *start, Token *end);
 
 Node *new_node(NodeKind kind, Token *tok);
 Node *new_node_binop(NodeKind kind, Node *lhs, Node *rhs, Token *tok);
@@ -169,6 +341,13 @@ struct Type {
     struct Type *base;  // pointer or array
     int array_size;     // array
     Map *members;       // struct
+
+    // Canonical derived types
+    Type *ptr;       // Pointer to this type
+    Type *arys;      // Arrays of this type, chained through next_ary
+    Type *next_ary;  // Next array type with the same base
+
+    bool is_transient;  // Struct types and types derived from them belong to a single compilation
 };
 
 Prog *assign_type(Prog *prog);
@@ -184,18 +363,24 @@ Type *enum_type();
 Type *ptr_to(Type *base);
 Type *ary_of(Type *base, int len);
 bool is_same_type(Type *x, Type *y);
+uint64_t hash_type(uint64_t h, Type *type);
+void release_types();
 
 // container.c
 struct Vector {
     void **data;
     int capacity;
     int len;
+    Arena *arena;  // Arena that data is allocated from, or NULL for the heap
 };
 
 struct Map {
-    Vector *keys;
-    Vector *vals;
+    Vector *keys;  // Vector<char *> of interned strings in insertion order
+    Vector *vals;  // Vector<void *> in insertion order
     int len;
+    int *index;    // Hash index from a key to its position in keys/vals; -1 marks an empty slot
+    int capacity;  // Number of slots in index (a power of two)
+    Arena *arena;  // Arena that index is allocated from, or NULL for the heap
 };
 
 Vector *vec_create();
@@ -208,16 +393,236 @@ void *vec_back(Vector *vec);
 
 Map *map_create();
 void map_insert(Map *map, char *key, void *val);
+void *map_find(Map *map, char *key);
 void *map_at(Map *map, char *key);
 bool map_contains(Map *map, char *key);
 
+char *intern(char *str, int len);
+size_t interned_size();
+void release_interned();
+
+#define HASH64_INIT 14695981039346656037ull
+
+uint64_t hash64(uint64_t h, void *data, size_t size);
+
+// arena.c
+#define ARENA_ALIGN 16
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+// A bump-pointer allocator. Objects are never freed one by one; the whole arena is released at once.
+struct Arena {
+    ArenaChunk *chunks;  // Allocated chunks, newest first
+    char *cur;           // Next free byte in the newest chunk
+    char *end;           // End of the newest chunk
+    size_t reserved;     // Bytes of all the chunks
+};
+
+// Kinds of objects that the memory report counts
+typedef enum {
+    AK_TOKEN,      // Tokens
+    AK_STRING,     // String literals and header names
+    AK_MACRO,      // Macros, their bodies, and their arguments
+    AK_HIDESET,    // Hide sets of expanded macros
+    AK_NODE,       // AST nodes and initializers
+    AK_VAR,        // Variables
+    AK_TYPE,       // Types
+    AK_MEMBER,     // Struct members
+    AK_FUNC,       // Functions
+    AK_SCOPE,      // Parser scopes and the bindings in them
+    AK_CONTAINER,  // Vectors and maps
+    AK_FORMAT,     // Strings made by format()
+    AK_BUFFER,     // Output buffers
+    AK_IDENT,      // Interned identifiers and paths, and the intern table
+    AK_SOURCE,     // Source files, their line tables, and cached headers
+    AK_OTHER,      // Everything else
+    NUM_ALLOC_KINDS
+} AllocKind;
+
+extern _Thread_local Arena type_arena;
+
+void count_alloc(AllocKind kind, size_t size);
+void *arena_alloc(Arena *arena, size_t size, AllocKind kind);
+void arena_release(Arena *arena);
+
+// emit.c
+struct Buffer {
+    char *data;
+    size_t capacity;
+    size_t len;
+};
+
+extern _Thread_local Buffer *out;
+
+Buffer *buf_create();
+Buffer *buf_create_cap(size_t capacity);
+void buf_free(Buffer *buf);
+void buf_append(Buffer *buf, char *s, size_t n);
+void emit(char *fmt, ...);
+void write_output(char *path, char *data, size_t size);
+
+// compiler.c
+struct File {
+    char *name;
+    char *contents;
+    size_t size;    // Length of contents
+    int *lines;     // Offset of the beginning of each line in contents
+    int num_lines;
+};
+
+// Phases of a compilation that the time report measures
+typedef enum {
+    PH_TOKENIZE,    // Tokenizing the source file
+    PH_PREPROCESS,  // Preprocessing, including reading the included files and the PCH
+    PH_CACHE,       // Looking up the output cache
+    PH_PARSE,       // Parsing into ASTs
+    PH_SEMA,        // Typing ASTs by assign_type()
+    PH_CODEGEN,     // Generating code or writing the PCH
+    NUM_PHASES
+} Phase;
+
+// The state of a single compilation. A thread runs one compilation at a time, which cc points to, so that several
+// files can be compiled in parallel. Interned strings and canonical types are per thread and outlive compilations.
+struct Compiler {
+    File *file;     // The file being compiled
+    Vector *files;  // Vector<File *> of the file being compiled and the files that it includes
+
+    // Tokenizer
+    Token *ctok;       // The current token
+    File *tok_file;    // The file being tokenized
+    Arena *tok_arena;  // Arena that tokens are allocated from
+    bool is_bol;       // true if the tokenizer is at beginning of a line
+    bool has_space;    // true if the tokenizer has skipped white space since the last token
+    int line_idx;      // Index of the line that the tokenizer is in
+
+    // Preprocessor
+    char **include_paths;  // Directories that #include searches
+    int num_include_paths;
+    char *working_dir;  // Directory that relative paths are resolved against, or NULL
+    Map *includes;      // Map<char *, Header *> of the files included so far, by their resolved paths
+    Map *missing;       // Map<char *, char *> of the resolved paths that #include looked for and did not find
+    Map *macros;        // Map<char *, Macro *> of macros; NULL marks an undefined one
+    int include_depth;  // Depth of nested #include
+    Vector *scratch;    // Vector<File *> of the text that # and ## make
+
+    // Parser
+    Prog *prog;  // The program
+    Func *fn;    // The function being parsed
+
+    // Identifiers and tags are resolved through hash maps from a name to its innermost binding. Each binding links to
+    // the one it shadows, and every push is recorded in an undo log so that leaving a scope can restore the shadowed
+    // bindings.
+    Map *var_scope;   // Map<char *, VarScope *>
+    Map *tag_scope;   // Map<char *, TagScope *>
+    Vector *var_log;  // Vector<VarScope *> in the order of pushes
+    Vector *tag_log;  // Vector<TagScope *> in the order of pushes
+    int scope_depth;
+
+    int str_label_cnt;
+
+    int codegen_jobs;       // Maximum number of threads that generate code for functions
+    char *cache_dir;        // Directory of the on-disk output cache, or NULL
+    bool incremental;       // Reuse the code of unchanged functions from cache_dir
+    FuncCache *func_cache;  // Function pack loaded in incremental mode, or NULL
+    char *emit_pch;         // Path to write a precompiled header to instead of assembly code, or NULL
+    char *include_pch;      // Path of a precompiled header to start from, or NULL
+    Pch *pch;               // The precompiled header loaded from include_pch, or NULL
+
+    // Diagnostics
+    TenccDiagnosticHandler on_diagnostic;
+    void *diagnostic_data;
+    pthread_mutex_t diagnostic_lock;  // Serializes reports from the threads of the compilation
+    bool failed;
+
+    Arena token_arena;  // Tokens and string literals
+    Arena ast_arena;    // Nodes, variables, functions, parser scopes, and struct types
+
+    // Time report
+    bool time_report;               // Print the time of each phase to stderr
+    double phase_wall[NUM_PHASES];  // Wall-clock seconds spent in each phase
+    double phase_cpu[NUM_PHASES];   // CPU seconds spent in each phase by the compiling thread and codegen workers
+    double phase_start_wall;        // Times when the current phase started
+    double phase_start_cpu;
+    long num_nodes;  // Number of AST nodes created
+
+    // Memory report, which codegen workers update as well
+    bool mem_report;                              // Print the allocations of each kind to stderr
+    _Atomic long alloc_count[NUM_ALLOC_KINDS];    // Number of allocations of each kind
+    _Atomic size_t alloc_bytes[NUM_ALLOC_KINDS];  // Bytes allocated for each kind
+
+    // Time trace
+    char *time_trace;            // Path to write a Chrome trace to, or NULL
+    Buffer *trace;               // Events of the trace, or NULL if the compilation is not traced
+    double trace_origin;         // Time when the compilation started, which is 0 in the trace
+    pthread_mutex_t trace_lock;  // Serializes events from codegen workers
+};
+
+extern _Thread_local Compiler *cc;
+
+char *read_source(char *path, size_t *size);
+File *new_file(char *name, char *src, size_t size);
+int find_line(File *file, char *loc);
+double cpu_seconds();
+extern _Thread_local int trace_tid;
+double trace_begin();
+void trace_end(char *name, char *cat, double start);
+int compile_source(char *name, char *src, size_t size, TenccOptions *opts, char **asm_out, size_t *asm_size,
+                   FileStamp **deps, int *num_deps);
+
+// cache.c
+char *cache_key(Token *tok);
+void cache_func_key(Token *start, Token *end, uint64_t key[2]);
+Buffer *cache_load(char *dir, char *file);
+void cache_store(char *dir, char *file, char *data, size_t size);
+
+// Function definitions of a translation unit reused by incremental compiles
+struct FuncCacheEntry {
+    uint64_t key[2];
+    char *code;  // NULL if the slot is empty
+    size_t size;
+};
+
+struct FuncCache {
+    Buffer *pack;  // Contents of the pack file, or NULL
+    FuncCacheEntry *entries;
+    int capacity;     // Power of two
+    int num_entries;
+};
+
+FuncCache *func_cache_open(char *dir, char *name);
+FuncCacheEntry *func_cache_find(FuncCache *fc, uint64_t key[2]);
+void func_cache_add(Buffer *pack, uint64_t key[2], char *code, size_t size);
+void func_cache_save(char *dir, char *name, Buffer *pack, bool append);
+void func_cache_close(FuncCache *fc);
+
+// pch.c
+void pch_write(char *path);
+Token *pch_load(char *path, Token *tok);
+void pch_restore();
+bool pch_contains(Pch *pch, FileStamp *stamp);
+uint64_t pch_hash(Pch *pch);
+void pch_close(Pch *pch);
+
 // codegen.c
-void codegen();
+void codegen(Prog *prog);
+
+// server.c
+void serve(char *path, int num_threads, char *cache_dir);
+int remote_compile(char *path, char *name, char *src, size_t size, TenccOptions *opts, char **asm_out,
+                   size_t *asm_size);
 
 // util.c
+extern _Thread_local jmp_buf *bailout;
+
 char *format(char *fmt, ...);
 void debug(char *fmt, ...);
 void error(char *fmt, ...);
 void error_at(char *loc, char *fmt, ...);
+void bail();
+char *format_diagnostic(TenccDiagnostic *diag);
+void print_diagnostic(TenccDiagnostic *diag);
 bool startswith(char *p, char *q);
 void draw_ast(Prog *prog);
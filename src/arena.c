@@ -0,0 +1,53 @@
+#include "10cc.h"
+
+size_t ARENA_CHUNK_SIZE = 1 << 20;
+
+_Thread_local Arena type_arena;  // Canonical types shared by the compilations on a thread
+
+// Allocate a new chunk that can hold at least size bytes, and make it the current chunk of an arena.
+void arena_grow(Arena *arena, size_t size) {
+    size_t cap = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    ArenaChunk *chunk = calloc(1, sizeof(ArenaChunk) + cap);
+    if (!chunk) {
+        error("out of memory");
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->reserved += cap;
+    arena->cur = chunk->data;
+    arena->end = chunk->data + cap;
+}
+
+// Count an allocation of an object of a kind if the compilation on this thread reports its memory.
+void count_alloc(AllocKind kind, size_t size) {
+    if (cc && cc->mem_report) {
+        cc->alloc_count[kind]++;
+        cc->alloc_bytes[kind] += size;
+    }
+}
+
+// Allocate zero-initialized memory for an object of a kind from an arena. The memory lives until the arena is
+// released.
+void *arena_alloc(Arena *arena, size_t size, AllocKind kind) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    count_alloc(kind, size);
+    if (arena->end - arena->cur < size) {
+        arena_grow(arena, size);
+    }
+    void *ptr = arena->cur;
+    arena->cur += size;
+    return ptr;
+}
+
+// Release all memory allocated from an arena. The arena can be reused afterward.
+void arena_release(Arena *arena) {
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->cur = arena->end = NULL;
+    arena->reserved = 0;
+}
@@ -0,0 +1,229 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "10cc.h"
+
+// The on-disk cache stores the assembly code of a translation unit in a file named after a 128-bit key. The key hashes
+// the token stream after preprocessing, so edits to whitespace and comments still hit. It also hashes the version of
+// the compiler, as the same tokens compile to different code with a different compiler. None of the options changes
+// the assembly code at present; an option that does must be hashed into the key as well.
+//
+// In incremental mode, the code of each function definition is also cached, under a key that hashes the tokens of the
+// definition and the declarations that they refer to (see hash_decls()). The function definitions of a translation
+// unit are kept together in a pack file named after the translation unit, which is read once before parsing and
+// rewritten after code generation. Reading thousands of small files would cost more than compiling the functions.
+//
+// Cache files are written to a temporary file first and renamed, so that a reader never sees a partial file even
+// when several processes share a directory. Failing to read or write the cache is not an error.
+
+#ifndef TENCC_BUILD_ID
+#define TENCC_BUILD_ID "unknown"
+#endif
+
+// Hash the tokens from tok to end (exclusive) or EOF into h.
+uint64_t hash_tokens(uint64_t h, Token *tok, Token *end) {
+    for (; tok != end && tok->kind != TK_EOF; tok = tok->next) {
+        h = hash64(h, &tok->kind, sizeof(tok->kind));
+        switch (tok->kind) {
+            case TK_RESERVED:
+                h = hash64(h, &tok->id, sizeof(tok->id));
+                break;
+            case TK_NUM:
+                h = hash64(h, &tok->val, sizeof(tok->val));
+                break;
+            default:
+                h = hash64(h, tok->str, strlen(tok->str) + 1);
+        }
+    }
+    return h;
+}
+
+// Initialize the two halves of a key with the version of the compiler.
+void init_key(uint64_t *h1, uint64_t *h2) {
+    char *version = TENCC_VERSION " " TENCC_BUILD_ID;
+    *h1 = hash64(HASH64_INIT, version, strlen(version) + 1);
+    *h2 = hash64(*h1 ^ 0x9E3779B97F4A7C15ull, version, strlen(version) + 1);
+}
+
+// Return the name of the cache file of the tokens from tok to EOF. It is allocated from the AST arena, so that it is
+// released with the compilation even if the compilation fails.
+char *cache_key(Token *tok) {
+    uint64_t h1, h2;
+    init_key(&h1, &h2);
+    h1 = hash_tokens(h1, tok, NULL);
+    h2 = hash_tokens(h2, tok, NULL);
+
+    // The declarations of a precompiled header change the code as the tokens do.
+    if (cc->pch) {
+        uint64_t h = pch_hash(cc->pch);
+        h1 = hash64(h1, &h, sizeof(h));
+        h2 = hash64(h2, &h, sizeof(h));
+    }
+    char *key = arena_alloc(&cc->ast_arena, 35, AK_STRING);  // 32 hex digits, ".s", and NUL
+    snprintf(key, 35, "%016llx%016llx.s", (unsigned long long)h1, (unsigned long long)h2);
+    return key;
+}
+
+// Compute the key of a function definition from start to end (exclusive).
+void cache_func_key(Token *start, Token *end, uint64_t key[2]) {
+    init_key(&key[0], &key[1]);
+    key[0] = hash_decls(hash_tokens(key[0], start, end), start, end);
+    key[1] = hash_decls(hash_tokens(key[1], start, end), start, end);
+}
+
+// Load a file from the cache. NULL is returned on a miss.
+Buffer *cache_load(char *dir, char *file) {
+    char *path = format("%s/%s", dir, file);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    Buffer *buf = buf_create_cap(st.st_size + 1);
+    while (buf->len < st.st_size) {
+        ssize_t n = read(fd, buf->data + buf->len, st.st_size - buf->len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        buf->len += n;
+    }
+    close(fd);
+    if (buf->len < st.st_size) {
+        buf_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// Store a file to the cache.
+void cache_store(char *dir, char *file, char *data, size_t size) {
+    mkdir(dir, 0755);
+    char *path = format("%s/%s", dir, file);
+    char *tmp = format("%s/%s.%d.%lu.tmp", dir, file, getpid(), (unsigned long)pthread_self());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd != -1) {
+        size_t off = 0;
+        while (off < size) {
+            ssize_t n = write(fd, data + off, size - off);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            off += n;
+        }
+        if (close(fd) == -1 || off < size || rename(tmp, path) == -1) {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    free(path);
+}
+
+// Return the name of the pack file of a translation unit.
+char *func_pack_file(char *name) {
+    return format("p%016llx.fn", (unsigned long long)hash64(HASH64_INIT, name, strlen(name)));
+}
+
+// Load the function pack of a translation unit, and index it. The pack is a sequence of entries, each of which is a key
+// (16 bytes), the size of code (8 bytes), and the code.
+FuncCache *func_cache_open(char *dir, char *name) {
+    FuncCache *fc = arena_alloc(&cc->ast_arena, sizeof(FuncCache), AK_OTHER);
+    char *file = func_pack_file(name);
+    fc->pack = cache_load(dir, file);
+    free(file);
+
+    // Count the entries.
+    int num_entries = 0;
+    size_t off = 0;
+    while (fc->pack && fc->pack->len - off >= 24) {
+        uint64_t size;
+        memcpy(&size, fc->pack->data + off + 16, 8);
+        if (fc->pack->len - off - 24 < size) {
+            break;
+        }
+        off += 24 + size;
+        num_entries++;
+    }
+    fc->num_entries = num_entries;
+
+    fc->capacity = 16;
+    while (fc->capacity < num_entries * 2) {
+        fc->capacity *= 2;
+    }
+    fc->entries = arena_alloc(&cc->ast_arena, sizeof(FuncCacheEntry) * fc->capacity, AK_OTHER);
+    off = 0;
+    for (int i = 0; i < num_entries; i++) {
+        FuncCacheEntry e;
+        memcpy(e.key, fc->pack->data + off, 16);
+        memcpy(&e.size, fc->pack->data + off + 16, 8);
+        e.code = fc->pack->data + off + 24;
+        off += 24 + e.size;
+        int mask = fc->capacity - 1;
+        int j = e.key[0] & mask;
+        while (fc->entries[j].code) {
+            j = (j + 1) & mask;
+        }
+        fc->entries[j] = e;
+    }
+    return fc;
+}
+
+// Find the code of a function definition by key. NULL is returned on a miss.
+FuncCacheEntry *func_cache_find(FuncCache *fc, uint64_t key[2]) {
+    int mask = fc->capacity - 1;
+    for (int i = key[0] & mask; fc->entries[i].code; i = (i + 1) & mask) {
+        FuncCacheEntry *e = &fc->entries[i];
+        if (e->key[0] == key[0] && e->key[1] == key[1]) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Append the code of a function definition to a new function pack.
+void func_cache_add(Buffer *pack, uint64_t key[2], char *code, size_t size) {
+    uint64_t size64 = size;
+    buf_append(pack, (char *)key, 16);
+    buf_append(pack, (char *)&size64, 8);
+    buf_append(pack, code, size);
+}
+
+// Replace the function pack of a translation unit, or append entries to it. A pack that a write left incomplete is
+// removed, as the entries after a partial one could not be found.
+void func_cache_save(char *dir, char *name, Buffer *pack, bool append) {
+    char *file = func_pack_file(name);
+    if (!append) {
+        cache_store(dir, file, pack->data, pack->len);
+        free(file);
+        return;
+    }
+
+    char *path = format("%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd != -1) {
+        if (write(fd, pack->data, pack->len) != pack->len) {
+            unlink(path);
+        }
+        close(fd);
+    }
+    free(path);
+    free(file);
+}
+
+// Release a function pack.
+void func_cache_close(FuncCache *fc) {
+    if (fc->pack) {
+        buf_free(fc->pack);
+    }
+}
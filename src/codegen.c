@@ -5,13 +5,45 @@ char *argregs2[] = {"di", "si", "dx", "cx", "r8w", "r9w"};
 char *argregs4[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
 char *argregs8[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
-char *funcname;
-int label_cnt;
-int break_cnt;
-int continue_cnt;
+// Functions are generated in parallel, so the state of generating a function is per thread. Labels are numbered per
+// function and qualified by its name, which makes the output independent of how functions are scheduled.
+_Thread_local char *funcname;
+_Thread_local int label_cnt;
+_Thread_local int break_cnt;     // Label number of the innermost breakable statement, or -1
+_Thread_local int continue_cnt;  // Label number of the innermost loop, or -1
 
+typedef struct FuncCode FuncCode;
+typedef struct CodegenPool CodegenPool;
+typedef struct CodegenWorker CodegenWorker;
+
+// The code of a function is generated into the buffer of the worker that picked it up, and then copied to the output
+// in the order of functions.
+struct FuncCode {
+    Buffer *buf;
+    size_t start;
+    size_t end;
+};
+
+struct CodegenPool {
+    Compiler *compiler;
+    Vector *fns;      // Vector<Func *> of functions with a body
+    FuncCode *codes;  // Generated code of each function in fns
+    int next;         // Index of the function that the next idle worker picks up
+    pthread_mutex_t lock;
+};
+
+struct CodegenWorker {
+    CodegenPool *pool;
+    Buffer *buf;
+    pthread_t thread;
+    int id;      // 1-origin number of the worker, which is its thread in the trace
+    double cpu;  // CPU seconds that the worker used
+};
+
+void gen_gvar(Var *var);
 void gen_data(Prog *prog);
 void gen_text(Prog *prog);
+void gen_func(Func *fn);
 void gen(Node *node);
 void gen_lval(Node *node);
 void load_arg(Var *var, int index);
@@ -22,69 +54,210 @@ void dec(Type *type);
 
 // Generate assembly code.
 void codegen(Prog *prog) {
-    printf(".intel_syntax noprefix\n");
+    emit(".intel_syntax noprefix\n");
     gen_data(prog);
     gen_text(prog);
 }
 
+// Generate assembly code for a global variable or a string literal.
+void gen_gvar(Var *var) {
+    emit("%s:\n", var->name);
+    if (var->data) {
+        for (int i = 0;; i++) {
+            emit("  .byte %d\n", var->data[i]);
+            if (!var->data[i]) {
+                break;
+            }
+        }
+    } else {
+        emit("  .zero %d\n", var->type->size);
+    }
+}
+
 // Generate assembly code for a data segment.
 void gen_data(Prog *prog) {
-    printf(".data\n");
+    emit(".data\n");
     for (int i = 0; i < prog->gvars->len; i++) {
-        Var *var = vec_at(prog->gvars, i);
-        printf("%s:\n", var->name);
-        if (var->data) {
-            for (int i = 0;; i++) {
-                printf("  .byte %d\n", var->data[i]);
-                if (!var->data[i]) {
-                    break;
-                }
+        gen_gvar(vec_at(prog->gvars, i));
+    }
+}
+
+// Generate code for functions that a pool hands out until none is left.
+void *codegen_worker(void *arg) {
+    CodegenWorker *worker = arg;
+    CodegenPool *pool = worker->pool;
+    cc = pool->compiler;  // for diagnostics
+    out = worker->buf;
+    trace_tid = worker->id;
+
+    double start = cpu_seconds();
+
+    // An error stops this worker, and the compilation is aborted once all the workers finish.
+    jmp_buf env;
+    bailout = &env;
+    if (!setjmp(env)) {
+        for (;;) {
+            pthread_mutex_lock(&pool->lock);
+            int i = pool->next++;
+            pthread_mutex_unlock(&pool->lock);
+            if (i >= pool->fns->len) {
+                break;
             }
-        } else {
-            printf("  .zero %d\n", var->type->size);
+            Func *fn = vec_at(pool->fns, i);
+            double begin = trace_begin();
+            pool->codes[i].buf = out;
+            pool->codes[i].start = out->len;
+            gen_func(fn);
+            pool->codes[i].end = out->len;
+            trace_end(fn->name, "codegen", begin);
         }
     }
+    worker->cpu = cpu_seconds() - start;
+    return NULL;
 }
 
-// Generate assemly code for a code segment.
+// Store the code of function definitions into the function pack of the file. Functions generated anew are appended to
+// the pack, and the pack is rewritten with only the current functions once most of its entries are stale.
+void store_funcs(Vector *fns, FuncCode *codes) {
+    int num_reused = 0;
+    for (int i = 0; i < fns->len; i++) {
+        num_reused += ((Func *)vec_at(fns, i))->code != NULL;
+    }
+    bool rewrite = !cc->func_cache->pack || cc->func_cache->num_entries - num_reused > num_reused;
+
+    Buffer *pack = buf_create();
+    for (int i = 0; i < fns->len; i++) {
+        Func *fn = vec_at(fns, i);
+        if (fn->key && (rewrite || !fn->code)) {
+            func_cache_add(pack, fn->key, codes[i].buf->data + codes[i].start, codes[i].end - codes[i].start);
+        }
+    }
+    if (rewrite || pack->len) {
+        func_cache_save(cc->cache_dir, cc->file->name, pack, !rewrite);
+    }
+    buf_free(pack);
+}
+
+// Generate assemly code for a code segment. Functions are generated by up to cc->codegen_jobs threads.
 void gen_text(Prog *prog) {
-    printf(".text\n");
+    emit(".text\n");
+
+    Vector *fns = vec_create();
     for (int i = 0; i < prog->fns->len; i++) {
         Func *fn = vec_at(prog->fns->vals, i);
-        if (!fn->body) {
-            continue;
+        if (fn->body || fn->code) {
+            vec_push(fns, fn);
         }
-        funcname = fn->name;
+    }
+    FuncCode *codes = calloc(fns->len, sizeof(FuncCode));
+    count_alloc(AK_OTHER, sizeof(FuncCode) * fns->len);
 
-        int offset = 0;
-        for (int i = 0; i < fn->lvars->len; i++) {
-            Var *var = vec_at(fn->lvars, i);
-            offset += var->type->size;
-            var->offset = offset;
+    int num_threads = cc->codegen_jobs < fns->len ? cc->codegen_jobs : fns->len;
+    Buffer *text = out;
+    CodegenPool pool = {cc, fns, codes, 0, PTHREAD_MUTEX_INITIALIZER};
+    CodegenWorker *workers = NULL;
+    int num_started = 0;
+    if (num_threads > 1) {
+        // If a thread cannot be created, the workers that have started generate all the functions, or this thread does
+        // if none has started.
+        workers = calloc(num_threads, sizeof(CodegenWorker));
+        count_alloc(AK_OTHER, sizeof(CodegenWorker) * num_threads);
+        for (; num_started < num_threads; num_started++) {
+            CodegenWorker *worker = &workers[num_started];
+            worker->pool = &pool;
+            worker->buf = buf_create();
+            worker->id = num_started + 1;
+            if (pthread_create(&worker->thread, NULL, codegen_worker, worker)) {
+                buf_free(worker->buf);
+                break;
+            }
         }
+    }
 
-        printf(".global %s\n", fn->name);
-        printf("%s:\n", fn->name);
+    if (num_started == 0) {
+        free(workers);
+        workers = NULL;
+        for (int i = 0; i < fns->len; i++) {
+            Func *fn = vec_at(fns, i);
+            double begin = trace_begin();
+            codes[i].buf = out;
+            codes[i].start = out->len;
+            gen_func(fn);
+            codes[i].end = out->len;
+            trace_end(fn->name, "codegen", begin);
+        }
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        cc->phase_cpu[PH_CODEGEN] += workers[i].cpu;
+    }
+    out = text;
 
-        // Prologue.
-        printf("  push rbp\n");
-        printf("  mov rbp, rsp\n");
-        printf("  sub rsp, %d\n", offset);
+    if (!cc->failed) {
+        for (int i = 0; num_started && i < fns->len; i++) {
+            buf_append(out, codes[i].buf->data + codes[i].start, codes[i].end - codes[i].start);
+        }
+        if (cc->incremental) {
+            store_funcs(fns, codes);
+        }
+    }
+    for (int i = 0; i < num_started; i++) {
+        buf_free(workers[i].buf);
+    }
+    free(workers);
+    free(codes);
+    if (cc->failed) {
+        bail();
+    }
+}
+
+// Generate assembly code for a function, including its string literals.
+void gen_func(Func *fn) {
+    if (fn->code) {
+        buf_append(out, fn->code, fn->code_size);
+        return;
+    }
 
-        // Push arguments to the stack.
-        for (int i = 0; i < fn->params->len; i++) {
-            load_arg(vec_at(fn->params, i), i);
+    if (fn->strs->len) {
+        emit(".data\n");
+        for (int i = 0; i < fn->strs->len; i++) {
+            gen_gvar(vec_at(fn->strs, i));
         }
+        emit(".text\n");
+    }
+
+    funcname = fn->name;
+    label_cnt = 0;
+    break_cnt = continue_cnt = -1;
 
-        // Emit code.
-        gen(fn->body);
+    int offset = 0;
+    for (int i = 0; i < fn->lvars->len; i++) {
+        Var *var = vec_at(fn->lvars, i);
+        offset += var->type->size;
+        var->offset = offset;
+    }
+
+    emit(".global %s\n", fn->name);
+    emit("%s:\n", fn->name);
+
+    // Prologue.
+    emit("  push rbp\n");
+    emit("  mov rbp, rsp\n");
+    emit("  sub rsp, %d\n", offset);
 
-        // Epilogue.
-        printf(".Lreturn.%s:\n", funcname);
-        printf("  mov rsp, rbp\n");
-        printf("  pop rbp\n");
-        printf("  ret\n");
+    // Push arguments to the stack.
+    for (int i = 0; i < fn->params->len; i++) {
+        load_arg(vec_at(fn->params, i), i);
     }
+
+    // Emit code.
+    gen(fn->body);
+
+    // Epilogue.
+    emit(".Lreturn.%s:\n", funcname);
+    emit("  mov rsp, rbp\n");
+    emit("  pop rbp\n");
+    emit("  ret\n");
 }
 
 // Generate assembly code for a given node.
@@ -94,10 +267,10 @@ void gen(Node *node) {
             return;
         case ND_NUM:
             if (node->val == (int)node->val) {
-                printf("  push %ld\n", node->val);
+                emit("  push %ld\n", node->val);
             } else {
-                printf("  movabs rax, %ld\n", node->val);
-                printf("  push rax\n");
+                emit("  movabs rax, %ld\n", node->val);
+                emit("  push rax\n");
             }
             return;
         case ND_ADDR:
@@ -116,32 +289,32 @@ void gen(Node *node) {
             return;
         case ND_NOT:
             gen(node->lhs);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  sete al\n");
-            printf("  movzx rax, al\n");
-            printf("  push rax\n");
+            emit("  pop rax\n");
+            emit("  cmp rax, 0\n");
+            emit("  sete al\n");
+            emit("  movzx rax, al\n");
+            emit("  push rax\n");
             return;
         case ND_BITNOT:
             gen(node->lhs);
-            printf("  pop rax\n");
-            printf("  not rax\n");
-            printf("  push rax\n");
+            emit("  pop rax\n");
+            emit("  not rax\n");
+            emit("  push rax\n");
             return;
         case ND_FUNC_CALL:
             for (int i = 0; i < node->args->len; i++) {
                 gen(vec_at(node->args, i));
             }
             for (int i = node->args->len - 1; i >= 0; i--) {
-                printf("  pop %s\n", argregs8[i]);
+                emit("  pop %s\n", argregs8[i]);
             }
-            printf("  mov al, 0\n");
-            printf("  call %s\n", node->func_name);
-            printf("  push rax\n");
+            emit("  mov al, 0\n");
+            emit("  call %s\n", node->func_name);
+            emit("  push rax\n");
             if (node->type->kind == TY_VOID) {
-                printf("  pop rax\n");
-                printf("  movsx rax, al\n");
-                printf("  push rax\n");
+                emit("  pop rax\n");
+                emit("  movsx rax, al\n");
+                emit("  push rax\n");
             }
             return;
         case ND_ASSIGN:
@@ -160,32 +333,32 @@ void gen(Node *node) {
         case ND_TERNARY: {
             int cur_label_cnt = label_cnt++;
             gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  je .Lelse%03d\n", cur_label_cnt);
+            emit("  pop rax\n");
+            emit("  cmp rax, 0\n");
+            emit("  je .Lelse.%s.%d\n", funcname, cur_label_cnt);
             gen(node->then);
-            printf("  jmp .Lend%03d\n", cur_label_cnt);
-            printf(".Lelse%03d:\n", cur_label_cnt);
+            emit("  jmp .Lend.%s.%d\n", funcname, cur_label_cnt);
+            emit(".Lelse.%s.%d:\n", funcname, cur_label_cnt);
             gen(node->els);
-            printf(".Lend%03d:\n", cur_label_cnt);
+            emit(".Lend.%s.%d:\n", funcname, cur_label_cnt);
             return;
         }
         case ND_IF: {
             int cur_label_cnt = label_cnt++;
             gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
+            emit("  pop rax\n");
+            emit("  cmp rax, 0\n");
             if (node->els) {
-                printf("  je .Lelse%03d\n", cur_label_cnt);
+                emit("  je .Lelse.%s.%d\n", funcname, cur_label_cnt);
                 gen(node->then);
-                printf("  jmp .Lend%03d\n", cur_label_cnt);
-                printf(".Lelse%03d:\n", cur_label_cnt);
+                emit("  jmp .Lend.%s.%d\n", funcname, cur_label_cnt);
+                emit(".Lelse.%s.%d:\n", funcname, cur_label_cnt);
                 gen(node->els);
             } else {
-                printf("  je .Lend%03d\n", cur_label_cnt);
+                emit("  je .Lend.%s.%d\n", funcname, cur_label_cnt);
                 gen(node->then);
             }
-            printf(".Lend%03d:\n", cur_label_cnt);
+            emit(".Lend.%s.%d:\n", funcname, cur_label_cnt);
             return;
         }
         case ND_WHILE: {
@@ -193,14 +366,15 @@ void gen(Node *node) {
             int cur_break_cnt = break_cnt;
             int cur_continue_cnt = continue_cnt;
             break_cnt = continue_cnt = cur_label_cnt;
-            printf(".Lbegin%03d:\n", cur_label_cnt);
+            emit(".Lbegin.%s.%d:\n", funcname, cur_label_cnt);
+            emit(".Lcontinue.%s.%d:\n", funcname, cur_label_cnt);
             gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  je .Lend%03d\n", cur_label_cnt);
+            emit("  pop rax\n");
+            emit("  cmp rax, 0\n");
+            emit("  je .Lend.%s.%d\n", funcname, cur_label_cnt);
             gen(node->then);
-            printf("  jmp .Lbegin%03d\n", cur_label_cnt);
-            printf(".Lend%03d:\n", cur_label_cnt);
+            emit("  jmp .Lbegin.%s.%d\n", funcname, cur_label_cnt);
+            emit(".Lend.%s.%d:\n", funcname, cur_label_cnt);
             break_cnt = cur_break_cnt;
             continue_cnt = cur_continue_cnt;
             return;
@@ -211,42 +385,42 @@ void gen(Node *node) {
             int cur_continue_cnt = continue_cnt;
             break_cnt = continue_cnt = cur_label_cnt;
             gen(node->init);
-            printf(".Lbegin%03d:\n", cur_label_cnt);
+            emit(".Lbegin.%s.%d:\n", funcname, cur_label_cnt);
             gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  je .Lend%03d\n", cur_label_cnt);
+            emit("  pop rax\n");
+            emit("  cmp rax, 0\n");
+            emit("  je .Lend.%s.%d\n", funcname, cur_label_cnt);
             gen(node->then);
-            printf(".Lcontinue%03d:\n", cur_label_cnt);
+            emit(".Lcontinue.%s.%d:\n", funcname, cur_label_cnt);
             gen(node->upd);
-            printf("  jmp .Lbegin%03d\n", cur_label_cnt);
-            printf(".Lend%03d:\n", cur_label_cnt);
+            emit("  jmp .Lbegin.%s.%d\n", funcname, cur_label_cnt);
+            emit(".Lend.%s.%d:\n", funcname, cur_label_cnt);
             break_cnt = cur_break_cnt;
             continue_cnt = cur_continue_cnt;
             return;
         }
         case ND_BREAK:
-            if (break_cnt == 0) {
+            if (break_cnt == -1) {
                 error_at(node->tok->loc, "break statement not within loop or switch");
             }
-            printf("  jmp .Lend%03d\n", break_cnt);
+            emit("  jmp .Lend.%s.%d\n", funcname, break_cnt);
             return;
         case ND_CONTINUE:
-            if (continue_cnt == 0) {
+            if (continue_cnt == -1) {
                 error_at(node->tok->loc, "continue statement not within loop or switch");
             }
-            printf("  jmp .Lcontinue%03d\n", continue_cnt);
+            emit("  jmp .Lcontinue.%s.%d\n", funcname, continue_cnt);
             return;
         case ND_RETURN:
             if (node->lhs) {
                 gen(node->lhs);
-                printf("  pop rax\n");
+                emit("  pop rax\n");
             }
-            printf("  jmp .Lreturn.%s\n", funcname);
+            emit("  jmp .Lreturn.%s\n", funcname);
             return;
         case ND_EXPR_STMT:
             gen(node->lhs);
-            printf("  add rsp, 8\n");
+            emit("  add rsp, 8\n");
             return;
         case ND_BLOCK:
         case ND_STMT_EXPR:
@@ -259,46 +433,46 @@ void gen(Node *node) {
     }
     gen(node->lhs);
     gen(node->rhs);
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
+    emit("  pop rdi\n");
+    emit("  pop rax\n");
     switch (node->kind) {
         case ND_EQ:
-            printf("  cmp rax, rdi\n");
-            printf("  sete al\n");
-            printf("  movzb rax, al\n");
+            emit("  cmp rax, rdi\n");
+            emit("  sete al\n");
+            emit("  movzb rax, al\n");
             break;
         case ND_NE:
-            printf("  cmp rax, rdi\n");
-            printf("  setne al\n");
-            printf("  movzb rax, al\n");
+            emit("  cmp rax, rdi\n");
+            emit("  setne al\n");
+            emit("  movzb rax, al\n");
             break;
         case ND_LE:
-            printf("  cmp rax, rdi\n");
-            printf("  setle al\n");
-            printf("  movzb rax, al\n");
+            emit("  cmp rax, rdi\n");
+            emit("  setle al\n");
+            emit("  movzb rax, al\n");
             break;
         case ND_LT:
-            printf("  cmp rax, rdi\n");
-            printf("  setl al\n");
-            printf("  movzb rax, al\n");
+            emit("  cmp rax, rdi\n");
+            emit("  setl al\n");
+            emit("  movzb rax, al\n");
             break;
         case ND_ADD:
-            printf("  add rax, rdi\n");
+            emit("  add rax, rdi\n");
             break;
         case ND_SUB:
-            printf("  sub rax, rdi\n");
+            emit("  sub rax, rdi\n");
             break;
         case ND_MUL:
-            printf("  imul rax, rdi\n");
+            emit("  imul rax, rdi\n");
             break;
         case ND_DIV:
-            printf("  cqo\n");
-            printf("  idiv rdi\n");
+            emit("  cqo\n");
+            emit("  idiv rdi\n");
             break;
         default:
             break;
     }
-    printf("  push rax\n");
+    emit("  push rax\n");
 }
 
 // Push an address to a lvalue to the stack.
@@ -306,20 +480,20 @@ void gen_lval(Node *node) {
     switch (node->kind) {
         case ND_VARREF:
             if (node->var->is_local) {
-                printf("  lea rax, [rbp-%d]\n", node->var->offset);
+                emit("  lea rax, [rbp-%d]\n", node->var->offset);
             } else {
-                printf("  lea rax, %s\n", node->var->name);
+                emit("  lea rax, %s\n", node->var->name);
             }
-            printf("  push rax\n");
+            emit("  push rax\n");
             break;
         case ND_DEREF:
             gen(node->lhs);
             break;
         case ND_MEMBER:
             gen_lval(node->lhs);
-            printf("  pop rax\n");
-            printf("  add rax, %d\n", node->member->offset);
-            printf("  push rax\n");
+            emit("  pop rax\n");
+            emit("  add rax, %d\n", node->member->offset);
+            emit("  push rax\n");
             break;
         default:
             // note: this error must be raised at assign_type().
@@ -331,16 +505,16 @@ void gen_lval(Node *node) {
 void load_arg(Var *var, int index) {
     switch (var->type->size) {
         case 1:
-            printf("  mov [rbp-%d], %s\n", var->offset, argregs1[index]);
+            emit("  mov [rbp-%d], %s\n", var->offset, argregs1[index]);
             break;
         case 2:
-            printf("  mov [rbp-%d], %s\n", var->offset, argregs2[index]);
+            emit("  mov [rbp-%d], %s\n", var->offset, argregs2[index]);
             break;
         case 4:
-            printf("  mov [rbp-%d], %s\n", var->offset, argregs4[index]);
+            emit("  mov [rbp-%d], %s\n", var->offset, argregs4[index]);
             break;
         case 8:
-            printf("  mov [rbp-%d], %s\n", var->offset, argregs8[index]);
+            emit("  mov [rbp-%d], %s\n", var->offset, argregs8[index]);
             break;
         default:
             error("cannot load the %d-th argument as a %d-byte variable", index, var->type->size);
@@ -349,53 +523,53 @@ void load_arg(Var *var, int index) {
 
 // Load a value from an address on the top of the stack, and push the value to the stack.
 void load(Type *type) {
-    printf("  pop rax\n");
+    emit("  pop rax\n");
     switch (type->size) {
         case 1:
-            printf("  movsx rax, byte ptr [rax]\n");
+            emit("  movsx rax, byte ptr [rax]\n");
             break;
         case 2:
-            printf("  movsx rax, word ptr [rax]\n");
+            emit("  movsx rax, word ptr [rax]\n");
             break;
         case 4:
-            printf("  movsx rax, dword ptr [rax]\n");
+            emit("  movsx rax, dword ptr [rax]\n");
             break;
         case 8:
-            printf("  mov rax, [rax]\n");
+            emit("  mov rax, [rax]\n");
             break;
         default:
             error("cannot load a %d-byte variable", type->size);
     }
-    printf("  push rax\n");
+    emit("  push rax\n");
 }
 
 // Load a value and an address from the top of the stack, and push the loaded value to the loaded address.
 void store(Type *type) {
-    printf("  pop rdi\n");  // value
-    printf("  pop rax\n");  // address
+    emit("  pop rdi\n");  // value
+    emit("  pop rax\n");  // address
 
     // A boolean value takes 0 if the value compares equal to 0; otherwise, 1.
     if (type->kind == TY_BOOL) {
-        printf("  cmp rdi, 0\n");
-        printf("  setne dil\n");
-        printf("  movzb rdi, dil\n");
+        emit("  cmp rdi, 0\n");
+        emit("  setne dil\n");
+        emit("  movzb rdi, dil\n");
     }
 
     switch (type->size) {
         case 1:
-            printf("  mov [rax], dil\n");
+            emit("  mov [rax], dil\n");
             break;
         case 2:
-            printf("  mov [rax], di\n");
+            emit("  mov [rax], di\n");
             break;
         case 4:
-            printf("  mov [rax], edi\n");
+            emit("  mov [rax], edi\n");
             break;
         case 8:
-            printf("  mov [rax], rdi\n");
+            emit("  mov [rax], rdi\n");
             break;
         default:
             error("cannot store a %d-byte variable", type->size);
     }
-    printf("  push rdi\n");
+    emit("  push rdi\n");
 }
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, open_memstream
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include "10cc.h"
+
+_Thread_local Compiler *cc;  // The compilation running on this thread
+
+char *phase_names[NUM_PHASES] = {"tokenize", "preprocess", "cache", "parse", "sema", "codegen"};
+char *alloc_kind_names[NUM_ALLOC_KINDS] = {"token", "string", "macro", "hideset", "node", "var", "type", "member",
+                                           "func", "scope", "container", "format", "buffer", "ident", "source",
+                                           "other"};
+
+// Read the contents of a file. The size of the contents is stored into *size.
+char *read_source(char *path, size_t *size) {
+    // Open the file.
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        error("cannot open %s: %s", path, strerror(errno));
+    }
+
+    // Investigate the file size.
+    if (fseek(fp, 0, SEEK_END) == -1) {
+        error("%s: fseek: %s", path, strerror(errno));
+    }
+    *size = ftell(fp);
+    if (fseek(fp, 0, SEEK_SET) == -1) {
+        error("%s: fseek: %s", path, strerror(errno));
+    }
+
+    // Read the file.
+    char *buff = malloc(*size + 1);
+    count_alloc(AK_SOURCE, *size + 1);
+    if (fread(buff, 1, *size, fp) != *size) {
+        error("%s: fread: %s", path, strerror(errno));
+    }
+    fclose(fp);
+    buff[*size] = '\0';
+    return buff;
+}
+
+// Create a file from source code, and build its line table. The source code is copied so that it ends with a new line.
+File *new_file(char *name, char *src, size_t size) {
+    char *buff = malloc(size + 2);
+    count_alloc(AK_SOURCE, size + 2);
+    memcpy(buff, src, size);
+
+    // Make sure that the file ends with a new line.
+    if (size == 0 || buff[size - 1] != '\n') {
+        buff[size++] = '\n';
+    }
+    buff[size] = '\0';
+
+    // Record where each line begins.
+    int num_lines = 0;
+    for (char *p = buff; (p = memchr(p, '\n', buff + size - p)); p++) {
+        num_lines++;
+    }
+    int *lines = malloc(sizeof(int) * num_lines);
+    count_alloc(AK_SOURCE, sizeof(int) * num_lines);
+    lines[0] = 0;
+    char *p = buff;
+    for (int n = 1; n < num_lines; n++) {
+        p = memchr(p, '\n', buff + size - p) + 1;
+        lines[n] = p - buff;
+    }
+
+    File *file = calloc(1, sizeof(File));
+    count_alloc(AK_SOURCE, sizeof(File));
+    file->name = name;
+    file->contents = buff;
+    file->size = size;
+    file->lines = lines;
+    file->num_lines = num_lines;
+    return file;
+}
+
+// Return the 0-origin index of the line that contains loc.
+int find_line(File *file, char *loc) {
+    int offset = loc - file->contents;
+    int lo = 0;
+    int hi = file->num_lines - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (file->lines[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Return the time of a clock in seconds.
+double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Return the CPU time of the calling thread in seconds.
+double cpu_seconds() { return clock_seconds(CLOCK_THREAD_CPUTIME_ID); }
+
+_Thread_local int trace_tid;  // Thread of the trace that this thread records events as; 0 is the compiling thread
+
+// Add an event to the trace of the compilation. args is JSON of the arguments of the event, or NULL.
+void trace_event(char *name, char *cat, double start, double end, char *args) {
+    char *event = format("\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,"
+                         "\"tid\":%d%s%s}",
+                         name, cat, (start - cc->trace_origin) * 1e6, (end - start) * 1e6, trace_tid,
+                         args ? ",\"args\":" : "", args ? args : "");
+    pthread_mutex_lock(&cc->trace_lock);
+    if (cc->trace->len) {
+        buf_append(cc->trace, ",", 1);
+    }
+    buf_append(cc->trace, event, strlen(event));
+    pthread_mutex_unlock(&cc->trace_lock);
+    free(event);
+}
+
+// Return the time that a span of the trace starts at, or 0 if the compilation is not traced.
+double trace_begin() { return cc->trace ? clock_seconds(CLOCK_MONOTONIC) : 0; }
+
+// Add a span that started at start and ends now to the trace of the compilation if it is traced.
+void trace_end(char *name, char *cat, double start) {
+    if (cc->trace) {
+        trace_event(name, cat, start, clock_seconds(CLOCK_MONOTONIC), NULL);
+    }
+}
+
+// Return a string as a JSON string literal.
+char *json_string(char *s) {
+    Buffer *buf = buf_create_cap(strlen(s) + 2);
+    buf_append(buf, "\"", 1);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            buf_append(buf, "\\", 1);
+        }
+        if ((unsigned char)*s < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", *s);
+            buf_append(buf, esc, 6);
+        } else {
+            buf_append(buf, s, 1);
+        }
+    }
+    buf_append(buf, "\"", 2);  // and the terminating NUL
+    char *str = buf->data;
+    free(buf);
+    return str;
+}
+
+// Write the trace of the compilation, which spans from its start until now, as Chrome trace-event JSON.
+void write_trace() {
+    char *name = json_string(cc->file->name);
+    char *args = format("{\"file\":%s}", name);
+    trace_event("compile", "compile", cc->trace_origin, clock_seconds(CLOCK_MONOTONIC), args);
+    free(args);
+    free(name);
+
+    Buffer *json = buf_create_cap(cc->trace->len + 64);
+    char *head = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    buf_append(json, head, strlen(head));
+    buf_append(json, cc->trace->data, cc->trace->len);
+    buf_append(json, "\n]}\n", 4);
+    write_output(cc->time_trace, json->data, json->len);
+    buf_free(json);
+}
+
+// Charge the time since the last call to a phase if the time report is enabled, and add it to the trace as a span if
+// the compilation is traced.
+void end_phase(Phase phase) {
+    if (!cc->time_report && !cc->trace) {
+        return;
+    }
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = cpu_seconds();
+    if (cc->trace) {
+        trace_event(phase_names[phase], "phase", cc->phase_start_wall, wall, NULL);
+    }
+    cc->phase_wall[phase] += wall - cc->phase_start_wall;
+    cc->phase_cpu[phase] += cpu - cc->phase_start_cpu;
+    cc->phase_start_wall = wall;
+    cc->phase_start_cpu = cpu;
+}
+
+// Print the time of each phase and the size of the compilation to stderr in a single write, so that the reports of
+// files compiled in parallel do not interleave.
+void print_time_report(long num_tokens, size_t output_size) {
+    int num_funcs = 0;
+    for (int i = 0; cc->prog && i < cc->prog->fns->len; i++) {
+        Func *fn = vec_at(cc->prog->fns->vals, i);
+        num_funcs += fn->body || fn->code;
+    }
+
+    char *report;
+    size_t size;
+    FILE *fp = open_memstream(&report, &size);
+    fprintf(fp, "time report for %s:\n", cc->file->name);
+    fprintf(fp, "  %-12s %10s %10s\n", "phase", "wall ms", "cpu ms");
+    double wall = 0;
+    double cpu = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        fprintf(fp, "  %-12s %10.3f %10.3f\n", phase_names[i], cc->phase_wall[i] * 1e3, cc->phase_cpu[i] * 1e3);
+        wall += cc->phase_wall[i];
+        cpu += cc->phase_cpu[i];
+    }
+    fprintf(fp, "  %-12s %10.3f %10.3f\n", "total", wall * 1e3, cpu * 1e3);
+
+    // Throughputs are per second of the whole compilation.
+    double secs = wall > 0 ? wall : 1e-9;
+    fprintf(fp, "  %-12s %10ld  (%.2f M/s)\n", "tokens", num_tokens, num_tokens / secs / 1e6);
+    fprintf(fp, "  %-12s %10ld  (%.2f M/s)\n", "nodes", cc->num_nodes, cc->num_nodes / secs / 1e6);
+    fprintf(fp, "  %-12s %10d\n", "functions", num_funcs);
+    fprintf(fp, "  %-12s %10zu  (%.2f MB/s)\n", "output bytes", output_size, output_size / secs / 1e6);
+    fclose(fp);
+    fputs(report, stderr);
+    free(report);
+}
+
+// Print the number and bytes of the allocations of each kind, the sizes of the arenas, and the peak RSS of the process
+// to stderr in a single write.
+void print_mem_report() {
+    char *report;
+    size_t size;
+    FILE *fp = open_memstream(&report, &size);
+    fprintf(fp, "memory report for %s:\n", cc->file->name);
+    fprintf(fp, "  %-12s %10s %14s\n", "kind", "count", "bytes");
+    long count = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < NUM_ALLOC_KINDS; i++) {
+        fprintf(fp, "  %-12s %10ld %14zu\n", alloc_kind_names[i], cc->alloc_count[i], cc->alloc_bytes[i]);
+        count += cc->alloc_count[i];
+        bytes += cc->alloc_bytes[i];
+    }
+    fprintf(fp, "  %-12s %10ld %14zu\n", "total", count, bytes);
+
+    // The arenas of types and headers are kept by the thread across compilations.
+    fprintf(fp, "  %-23s %14zu\n", "token arena", cc->token_arena.reserved);
+    fprintf(fp, "  %-23s %14zu\n", "AST arena", cc->ast_arena.reserved);
+    fprintf(fp, "  %-23s %14zu\n", "type arena (thread)", type_arena.reserved);
+    fprintf(fp, "  %-23s %14zu\n", "header arena (thread)", header_arena.reserved);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(fp, "  %-23s %11ld KB\n", "peak RSS (process)", usage.ru_maxrss);
+    fclose(fp);
+    fputs(report, stderr);
+    free(report);
+}
+
+// Compile source code into assembly code as tencc_compile() does. If deps is not NULL, the stamps of the files that the
+// result depends on are stored into *deps (see dependencies()) on success.
+int compile_source(char *name, char *src, size_t size, TenccOptions *opts, char **asm_out, size_t *asm_size,
+                   FileStamp **deps, int *num_deps) {
+    // The context is not an automatic variable, so that it survives longjmp() intact.
+    cc = calloc(1, sizeof(Compiler));
+    if (opts) {
+        cc->mem_report = opts->mem_report;  // First, so that the allocations below are counted
+        cc->codegen_jobs = opts->codegen_jobs;
+        cc->on_diagnostic = opts->on_diagnostic;
+        cc->diagnostic_data = opts->diagnostic_data;
+        cc->cache_dir = opts->cache_dir;
+        cc->incremental = opts->incremental && opts->cache_dir;
+        cc->include_paths = opts->include_paths;
+        cc->num_include_paths = opts->num_include_paths;
+        cc->working_dir = opts->working_dir;
+        cc->emit_pch = opts->emit_pch ? resolve_path(opts->emit_pch) : NULL;
+        cc->include_pch = opts->include_pch ? resolve_path(opts->include_pch) : NULL;
+        cc->time_report = opts->time_report;
+        cc->time_trace = opts->time_trace ? resolve_path(opts->time_trace) : NULL;
+    }
+    count_alloc(AK_OTHER, sizeof(Compiler));
+    if (cc->time_trace) {
+        cc->trace = buf_create();
+        trace_tid = 0;
+    }
+    if (cc->time_report || cc->trace) {
+        cc->phase_start_wall = cc->trace_origin = clock_seconds(CLOCK_MONOTONIC);
+        cc->phase_start_cpu = cpu_seconds();
+    }
+    pthread_mutex_init(&cc->diagnostic_lock, NULL);
+    pthread_mutex_init(&cc->trace_lock, NULL);
+
+    // An error in this thread resumes here.
+    jmp_buf env;
+    bailout = &env;
+    if (!setjmp(env)) {
+        cc->file = new_file(name, src, size);
+        cc->files = vec_create();
+        vec_push(cc->files, cc->file);
+        if (cc->emit_pch && cc->include_pch) {
+            error("a precompiled header cannot be built from another one");
+        }
+        Token *tok = tokenize(cc->file, &cc->token_arena);
+        end_phase(PH_TOKENIZE);
+        if (cc->include_pch) {
+            tok = pch_load(cc->include_pch, tok);
+        }
+        cc->ctok = preprocess(tok);
+        long num_tokens = 0;
+        for (Token *t = cc->ctok; cc->time_report && t->kind != TK_EOF; t = t->next) {
+            num_tokens++;
+        }
+        end_phase(PH_PREPROCESS);
+
+        // A hit in the cache skips the rest of the compilation.
+        char *key = cc->cache_dir && !cc->emit_pch ? cache_key(cc->ctok) : NULL;
+        out = key ? cache_load(cc->cache_dir, key) : NULL;
+        end_phase(PH_CACHE);
+        if (!out) {
+            if (cc->incremental && !cc->emit_pch) {
+                cc->func_cache = func_cache_open(cc->cache_dir, name);
+            }
+            Prog *prog = parse();
+            end_phase(PH_PARSE);
+            out = buf_create();
+            if (cc->emit_pch) {
+                pch_write(cc->emit_pch);
+            } else {
+                prog = assign_type(prog);
+                end_phase(PH_SEMA);
+                // draw_ast(prog);
+                codegen(prog);
+            }
+            if (key) {
+                cache_store(cc->cache_dir, key, out->data, out->len);
+            }
+            end_phase(PH_CODEGEN);
+        }
+        if (deps) {
+            *deps = dependencies(num_deps);
+        }
+        if (cc->time_report) {
+            print_time_report(num_tokens, out->len);
+        }
+        if (cc->mem_report) {
+            print_mem_report();
+        }
+        if (cc->trace) {
+            write_trace();
+        }
+
+        // Hand the output over to the caller.
+        buf_append(out, "", 1);
+        *asm_out = out->data;
+        if (asm_size) {
+            *asm_size = out->len - 1;
+        }
+        free(out);
+        out = NULL;
+    }
+
+    // Tokens, ASTs, and struct types are no longer referenced once assembly code is emitted.
+    if (out) {
+        buf_free(out);
+        out = NULL;
+    }
+    if (cc->trace) {
+        buf_free(cc->trace);
+    }
+    if (cc->func_cache) {
+        func_cache_close(cc->func_cache);
+    }
+    if (cc->pch) {
+        pch_close(cc->pch);
+    }
+    for (int i = 0; cc->scratch && i < cc->scratch->len; i++) {
+        File *file = vec_at(cc->scratch, i);
+        free(file->contents);
+        free(file->lines);
+        free(file);
+    }
+    arena_release(&cc->ast_arena);
+    arena_release(&cc->token_arena);
+    if (cc->file) {
+        free(cc->file->contents);
+        free(cc->file->lines);
+        free(cc->file);
+    }
+    pthread_mutex_destroy(&cc->diagnostic_lock);
+    pthread_mutex_destroy(&cc->trace_lock);
+    int ret = cc->failed ? -1 : 0;
+    free(cc);
+    bailout = NULL;
+    cc = NULL;
+    return ret;
+}
+
+// Compile source code into assembly code. See tencc.h for details.
+int tencc_compile(char *name, char *src, size_t size, TenccOptions *opts, char **asm_out, size_t *asm_size) {
+    return compile_source(name, src, size, opts, asm_out, asm_size, NULL, NULL);
+}
@@ -2,12 +2,24 @@
 
 int INITIAL_VECTOR_SIZE = 32;
 
+// Allocate memory for a container. Containers created during a compilation are allocated from its AST arena so that
+// they are released together with the AST, and the others are allocated from the heap.
+void *container_alloc(Arena *arena, size_t size) {
+    if (arena) {
+        return arena_alloc(arena, size, AK_CONTAINER);
+    }
+    count_alloc(AK_CONTAINER, size);
+    return malloc(size);
+}
+
 // Create an empty vector.
 Vector *vec_create() {
-    Vector *vec = malloc(sizeof(Vector));
-    vec->data = malloc(sizeof(void *) * INITIAL_VECTOR_SIZE);
+    Arena *arena = cc ? &cc->ast_arena : NULL;
+    Vector *vec = container_alloc(arena, sizeof(Vector));
+    vec->data = container_alloc(arena, sizeof(void *) * INITIAL_VECTOR_SIZE);
     vec->capacity = INITIAL_VECTOR_SIZE;
     vec->len = 0;
+    vec->arena = arena;
     return vec;
 }
 
@@ -15,7 +27,14 @@ Vector *vec_create() {
 void vec_push(Vector *vec, void *item) {
     if (vec->len == vec->capacity) {
         vec->capacity *= 2;
-        vec->data = realloc(vec->data, sizeof(void *) * vec->capacity);
+        if (vec->arena) {
+            void **data = arena_alloc(vec->arena, sizeof(void *) * vec->capacity, AK_CONTAINER);
+            memcpy(data, vec->data, sizeof(void *) * vec->len);
+            vec->data = data;
+        } else {
+            vec->data = realloc(vec->data, sizeof(void *) * vec->capacity);
+            count_alloc(AK_CONTAINER, sizeof(void *) * vec->capacity);
+        }
     }
     vec->data[vec->len++] = item;
 }
@@ -46,45 +65,160 @@ void *vec_set(Vector *vec, int index, void *item) {
 // Get the last item of a vector. Calling vec_back on an empty container causes undefined behavior.
 void *vec_back(Vector *vec) { return vec->data[vec->len - 1]; }
 
-// Create an empty map.
+int INITIAL_MAP_INDEX_SIZE = 16;
+
+// Compute the FNV-1a hash of the first len bytes of a string.
+uint32_t hash_str(char *s, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Compute the 64-bit FNV-1a hash of size bytes, continuing from a given hash. Pass HASH64_INIT to start a new hash.
+uint64_t hash64(uint64_t h, void *data, size_t size) {
+    unsigned char *p = data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Compute the hash of a pointer.
+uint32_t hash_ptr(void *p) { return (uint32_t)(((uintptr_t)p * 0x9E3779B97F4A7C15ull) >> 32); }
+
+// Find the index slot for a key. The returned slot holds either the key's position or -1.
+int map_slot(Map *map, char *key) {
+    int mask = map->capacity - 1;
+    for (int i = hash_ptr(key) & mask;; i = (i + 1) & mask) {
+        int pos = map->index[i];
+        if (pos == -1 || map->keys->data[pos] == key) {
+            return i;
+        }
+    }
+}
+
+// Rebuild the index with a given number of slots, which must be a power of two.
+void map_rehash(Map *map, int capacity) {
+    if (!map->arena) {
+        free(map->index);
+    }
+    map->index = container_alloc(map->arena, sizeof(int) * capacity);
+    map->capacity = capacity;
+    for (int i = 0; i < capacity; i++) {
+        map->index[i] = -1;
+    }
+    for (int pos = 0; pos < map->len; pos++) {
+        map->index[map_slot(map, map->keys->data[pos])] = pos;
+    }
+}
+
+// Create an empty map. Keys are kept in insertion order in `keys`, and `index` is an open-addressing hash table that
+// maps a key to its position. Keys must be interned strings (see intern()) since they are compared by address.
 Map *map_create() {
-    Map *map = malloc(sizeof(Map));
+    Arena *arena = cc ? &cc->ast_arena : NULL;
+    Map *map = container_alloc(arena, sizeof(Map));
+    map->arena = arena;
     map->keys = vec_create();
     map->vals = vec_create();
     map->len = 0;
+    map->index = NULL;
+    map_rehash(map, INITIAL_MAP_INDEX_SIZE);
     return map;
 }
 
-// Insert an item to a map.
+// Insert an item to a map. If the key already exists, its value is replaced and its position is kept.
 void map_insert(Map *map, char *key, void *val) {
-    for (int i = 0; i < map->len; i++) {
-        if (!strcmp(vec_at(map->keys, i), key)) {
-            map->vals->data[i] = val;
-            return;
-        }
+    int slot = map_slot(map, key);
+    if (map->index[slot] != -1) {
+        map->vals->data[map->index[slot]] = val;
+        return;
     }
+    map->index[slot] = map->len;
     vec_push(map->keys, key);
     vec_push(map->vals, val);
     map->len++;
+    if (map->len * 2 > map->capacity) {
+        map_rehash(map, map->capacity * 2);
+    }
+}
+
+// Get an item from a map. If no such item exists, return NULL.
+void *map_find(Map *map, char *key) {
+    int pos = map->index[map_slot(map, key)];
+    return pos == -1 ? NULL : map->vals->data[pos];
 }
 
 // Get an item from a map. If no such item exists, raise an error.
 void *map_at(Map *map, char *key) {
-    for (int i = 0; i < map->len; i++) {
-        if (!strcmp(vec_at(map->keys, i), key)) {
-            return vec_at(map->vals, i);
-        }
+    int pos = map->index[map_slot(map, key)];
+    if (pos == -1) {
+        error("out of range");
     }
-    error("out of range");
-    return NULL;  // unreachable
+    return map->vals->data[pos];
 }
 
 // Check if there is an element with key.
-bool map_contains(Map *map, char *key) {
-    for (int i = 0; i < map->len; i++) {
-        if (!strcmp(vec_at(map->keys, i), key)) {
-            return true;
+bool map_contains(Map *map, char *key) { return map->index[map_slot(map, key)] != -1; }
+
+int INITIAL_INTERN_SIZE = 1024;
+
+// Each thread has its own table, which is kept across compilations on the thread.
+_Thread_local char **interned;        // Open-addressing hash set of interned strings
+_Thread_local int interned_cap;       // Number of slots in interned (a power of two)
+_Thread_local int interned_len;       // Number of interned strings
+_Thread_local size_t interned_bytes;  // Bytes of the interned strings
+
+// Find the slot for a string in the intern table. The returned slot holds either the string or NULL.
+int intern_slot(char **table, int cap, char *str, int len) {
+    int mask = cap - 1;
+    for (int i = hash_str(str, len) & mask;; i = (i + 1) & mask) {
+        char *s = table[i];
+        if (!s || (!strncmp(s, str, len) && !s[len])) {
+            return i;
         }
     }
-    return false;
+}
+
+// Return the unique copy of the first len bytes of a string. Two interned strings are equal iff their addresses are.
+char *intern(char *str, int len) {
+    if (interned_len * 2 >= interned_cap) {
+        int cap = interned_cap ? interned_cap * 2 : INITIAL_INTERN_SIZE;
+        char **table = calloc(cap, sizeof(char *));
+        count_alloc(AK_IDENT, sizeof(char *) * cap);
+        for (int i = 0; i < interned_cap; i++) {
+            if (interned[i]) {
+                table[intern_slot(table, cap, interned[i], strlen(interned[i]))] = interned[i];
+            }
+        }
+        free(interned);
+        interned = table;
+        interned_cap = cap;
+    }
+    int slot = intern_slot(interned, interned_cap, str, len);
+    if (!interned[slot]) {
+        char *s = malloc(len + 1);
+        count_alloc(AK_IDENT, len + 1);
+        memcpy(s, str, len);
+        s[len] = '\0';
+        interned[slot] = s;
+        interned_len++;
+        interned_bytes += len + 1;
+    }
+    return interned[slot];
+}
+
+// Return the bytes that the intern table of this thread holds.
+size_t interned_size() { return interned_bytes + sizeof(char *) * interned_cap; }
+
+// Free the interned strings of this thread. No interned string of the thread may be in use.
+void release_interned() {
+    for (int i = 0; i < interned_cap; i++) {
+        free(interned[i]);
+    }
+    free(interned);
+    interned = NULL;
+    interned_cap = interned_len = 0;
+    interned_bytes = 0;
 }
@@ -0,0 +1,138 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "10cc.h"
+
+size_t INITIAL_BUFFER_SIZE = 1 << 16;
+
+_Thread_local Buffer *out;  // The buffer that emit() appends to on this thread
+
+// Create an empty buffer.
+Buffer *buf_create() { return buf_create_cap(INITIAL_BUFFER_SIZE); }
+
+// Create an empty buffer that holds capacity bytes before growing.
+Buffer *buf_create_cap(size_t capacity) {
+    Buffer *buf = malloc(sizeof(Buffer));
+    buf->data = malloc(capacity ? capacity : 1);
+    buf->capacity = capacity ? capacity : 1;
+    buf->len = 0;
+    count_alloc(AK_BUFFER, sizeof(Buffer) + buf->capacity);
+    return buf;
+}
+
+// Make room for at least n more bytes in a buffer.
+void buf_reserve(Buffer *buf, size_t n) {
+    if (buf->len + n <= buf->capacity) {
+        return;
+    }
+    size_t old_capacity = buf->capacity;
+    while (buf->len + n > buf->capacity) {
+        buf->capacity *= 2;
+    }
+    buf->data = realloc(buf->data, buf->capacity);
+    count_alloc(AK_BUFFER, buf->capacity - old_capacity);
+}
+
+// Append n bytes to a buffer.
+void buf_append(Buffer *buf, char *s, size_t n) {
+    buf_reserve(buf, n);
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+}
+
+// Append a decimal integer to a buffer, left-padding it with zeros to at least width digits.
+void buf_append_int(Buffer *buf, long val, int width) {
+    char digits[24];
+    int n = 0;
+    unsigned long u = val < 0 ? -(unsigned long)val : val;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n < width) {
+        digits[n++] = '0';
+    }
+    if (val < 0) {
+        digits[n++] = '-';
+    }
+    buf_reserve(buf, n);
+    while (n) {
+        buf->data[buf->len++] = digits[--n];
+    }
+}
+
+// Append formatted text to the output buffer. Only the conversions that codegen needs are supported:
+// %s, %d, %ld, and %0Nd (zero-padded to N digits).
+void emit(char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    char *p = fmt;
+    for (;;) {
+        char *start = p;
+        while (*p && *p != '%') {
+            p++;
+        }
+        buf_append(out, start, p - start);
+        if (!*p) {
+            break;
+        }
+        p++;  // %
+
+        int width = 0;
+        if (*p == '0') {
+            p++;
+            while (isdigit(*p)) {
+                width = width * 10 + (*p++ - '0');
+            }
+        }
+        switch (*p++) {
+            case 's': {
+                char *s = va_arg(ap, char *);
+                buf_append(out, s, strlen(s));
+                break;
+            }
+            case 'd':
+                buf_append_int(out, va_arg(ap, int), width);
+                break;
+            case 'l':
+                if (*p++ != 'd') {
+                    error("emit: unsupported conversion in '%s'", fmt);
+                }
+                buf_append_int(out, va_arg(ap, long), width);
+                break;
+            default:
+                error("emit: unsupported conversion in '%s'", fmt);
+        }
+    }
+    va_end(ap);
+}
+
+// Free a buffer.
+void buf_free(Buffer *buf) {
+    free(buf->data);
+    free(buf);
+}
+
+// Write data to a file at once. If path is NULL, write it to the standard output.
+void write_output(char *path, char *data, size_t size) {
+    int fd = 1;
+    if (path) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            error("cannot open %s: %s", path, strerror(errno));
+        }
+    }
+    for (size_t off = 0; off < size;) {
+        ssize_t n = write(fd, data + off, size - off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error("%s: write: %s", path ? path : "stdout", strerror(errno));
+        }
+        off += n;
+    }
+    if (path && close(fd) == -1) {
+        error("%s: close: %s", path, strerror(errno));
+    }
+}
@@ -1,51 +1,255 @@
+#include <unistd.h>
+
 #include "10cc.h"
 
-char *file_name;
-char *user_input;
+Vector *inputs;         // Vector<char *> of input file paths
+Vector *include_paths;  // Vector<char *> of directories that #include searches (-I)
+char *output_path;      // NULL means the standard output
+int num_jobs;           // Maximum number of threads
+int codegen_jobs;       // Maximum number of threads that generate code for each file
+char *server_path;      // Socket to serve jobs on (--server)
+char *client_path;      // Socket of a server to compile on (--client)
+char *cache_dir;        // Directory of the on-disk output cache (--cache-dir or TENCC_CACHE_DIR)
+bool incremental;       // Cache the code of each function as well (--incremental)
+char *emit_pch;         // Write a precompiled header instead of assembly code (--emit-pch)
+char *include_pch;      // Start from a precompiled header (--include-pch)
+bool time_report;       // Print the time of each phase (-ftime-report)
+bool mem_report;        // Print the allocations of each kind (-fmem-report)
+char *time_trace;       // Write a Chrome trace (-ftime-trace=<file>)
+
+int next_input;  // Index of the input that the next idle worker picks up
+bool failed;     // true if an input failed to compile
+pthread_mutex_t next_input_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void usage() {
+    error("usage: 10cc [--cache-dir <dir> [--incremental]] [--include-pch <pch>] [-I <dir>]... [-j <jobs>] "
+          "[-ftime-report] [-fmem-report] [-ftime-trace=<file>] [-o <path>] <file>...\n"
+          "       10cc --client <socket> [-I <dir>]... [-j <jobs>] [-o <path>] <file>...\n"
+          "       10cc --emit-pch <pch> [-I <dir>]... <file>\n"
+          "       10cc --server <socket> [--cache-dir <dir>] [-j <jobs>]");
+}
+
+// Parse the number of jobs.
+int parse_jobs(char *arg) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (*end || n <= 0) {
+        error("invalid number of jobs: %s", arg);
+    }
+    return n;
+}
+
+// Return the output path for an input. A single input is compiled to output_path, and each of multiple inputs is
+// compiled to <basename>.s in the current directory.
+char *output_path_of(char *input) {
+    if (inputs->len == 1) {
+        return output_path;
+    }
+    char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    char *dot = strrchr(base, '.');
+    int len = dot ? dot - base : strlen(base);
+    return format("%.*s.s", len, base);
+}
+
+// Parse command line options.
+void parse_args(int argc, char **argv) {
+    inputs = vec_create();
+    include_paths = vec_create();
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "-I") || !strcmp(argv[i], "-j") ||
+            !strcmp(argv[i], "--server") || !strcmp(argv[i], "--client") || !strcmp(argv[i], "--cache-dir") ||
+            !strcmp(argv[i], "--emit-pch") || !strcmp(argv[i], "--include-pch")) {
+            if (i + 1 == argc) {
+                usage();
+            }
+            char *opt = argv[i++];
+            if (!strcmp(opt, "-o")) {
+                output_path = argv[i];
+            } else if (!strcmp(opt, "-I")) {
+                vec_push(include_paths, argv[i]);
+            } else if (!strcmp(opt, "-j")) {
+                num_jobs = parse_jobs(argv[i]);
+            } else if (!strcmp(opt, "--server")) {
+                server_path = argv[i];
+            } else if (!strcmp(opt, "--cache-dir")) {
+                cache_dir = argv[i];
+            } else if (!strcmp(opt, "--emit-pch")) {
+                emit_pch = argv[i];
+            } else if (!strcmp(opt, "--include-pch")) {
+                include_pch = argv[i];
+            } else {
+                client_path = argv[i];
+            }
+            continue;
+        }
+        if (!strcmp(argv[i], "--incremental")) {
+            incremental = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-ftime-report")) {
+            time_report = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-fmem-report")) {
+            mem_report = true;
+            continue;
+        }
+        if (!strncmp(argv[i], "-ftime-trace=", 13) && argv[i][13]) {
+            time_trace = argv[i] + 13;
+            continue;
+        }
+        if (!strncmp(argv[i], "-o", 2)) {
+            output_path = argv[i] + 2;
+            continue;
+        }
+        if (!strncmp(argv[i], "-I", 2)) {
+            vec_push(include_paths, argv[i] + 2);
+            continue;
+        }
+        if (!strncmp(argv[i], "-j", 2)) {
+            num_jobs = parse_jobs(argv[i] + 2);
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1]) {
+            error("unknown argument: %s", argv[i]);
+        }
+        vec_push(inputs, argv[i]);
+    }
+    if (server_path ? inputs->len || output_path || client_path : inputs->len == 0) {
+        usage();
+    }
+    if (inputs->len > 1 && output_path) {
+        error("cannot specify -o with multiple files");
+    }
+    if (emit_pch && (inputs->len > 1 || output_path)) {
+        error("--emit-pch takes a single file and no -o");
+    }
+    if ((emit_pch || include_pch) && client_path) {
+        error("precompiled headers cannot be used with --client");
+    }
+    if ((time_report || mem_report || time_trace) && client_path) {
+        error("-ftime-report, -fmem-report, and -ftime-trace cannot be used with --client");
+    }
+    if ((cache_dir || incremental) && client_path) {
+        error("--cache-dir and --incremental cannot be used with --client; the server has its own cache");
+    }
+    if (time_trace && inputs->len > 1) {
+        error("-ftime-trace takes a single file");
+    }
+    // Inputs of the same basename in different directories would be compiled to the same output.
+    Vector *outputs = vec_create();
+    for (int i = 0; i < inputs->len && inputs->len > 1; i++) {
+        vec_push(outputs, output_path_of(vec_at(inputs, i)));
+        for (int j = 0; j < i; j++) {
+            if (!strcmp(vec_at(outputs, i), vec_at(outputs, j))) {
+                error("%s and %s would both be compiled to %s", (char *)vec_at(inputs, j), (char *)vec_at(inputs, i),
+                      (char *)vec_at(outputs, i));
+            }
+        }
+    }
+    if (num_jobs == 0) {
+        num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (!cache_dir && getenv("TENCC_CACHE_DIR") && *getenv("TENCC_CACHE_DIR")) {
+        cache_dir = getenv("TENCC_CACHE_DIR");
+    }
+    if (incremental && !cache_dir) {
+        error("--incremental requires a cache directory");
+    }
+
+    // Files are compiled in parallel first, and the threads left over generate code of each file in parallel.
+    codegen_jobs = num_jobs > inputs->len ? num_jobs / (inputs->len ? inputs->len : 1) : 1;
+}
 
-void usage() { error("no input files"); }
+// Print a diagnostic of a compilation.
+void on_diagnostic(TenccDiagnostic *diag, void *data) { print_diagnostic(diag); }
 
-// Read a file.
-char *read_file(char *path) {
-    // Open the file.
-    FILE *fp = fopen(path, "r");
-    if (!fp) {
-        error("cannot open %s: %s", path, strerror(errno));
+// Compile an input file, and return true on success. A file that cannot be read or written fails only this input.
+bool compile_input(char *input) {
+    jmp_buf env;
+    bailout = &env;
+    if (setjmp(env)) {
+        bailout = NULL;
+        return false;
     }
+    size_t size;
+    char *src = read_source(input, &size);
+    bailout = NULL;
 
-    // Investigate the file size.
-    if (fseek(fp, 0, SEEK_END) == -1) {
-        error("%s: fseek: %s", path, strerror(errno));
+    TenccOptions opts = {
+        .codegen_jobs = codegen_jobs,
+        .on_diagnostic = on_diagnostic,
+        .cache_dir = cache_dir,
+        .incremental = incremental,
+        .include_paths = (char **)include_paths->data,
+        .num_include_paths = include_paths->len,
+        .emit_pch = emit_pch,
+        .include_pch = include_pch,
+        .time_report = time_report,
+        .mem_report = mem_report,
+        .time_trace = time_trace,
+    };
+    char *asm_code;
+    size_t asm_size;
+    bool ok;
+    if (client_path) {
+        ok = !remote_compile(client_path, input, src, size, &opts, &asm_code, &asm_size);
+    } else {
+        ok = !tencc_compile(input, src, size, &opts, &asm_code, &asm_size);
     }
-    size_t size = ftell(fp);
-    if (fseek(fp, 0, SEEK_SET) == -1) {
-        error("%s: fseek: %s", path, strerror(errno));
+    free(src);
+    if (!ok) {
+        return false;
     }
 
-    // Read the file.
-    char *buff = calloc(1, size + 2);
-    fread(buff, size, 1, fp);
-    fclose(fp);
+    if (!emit_pch) {
+        bailout = &env;
+        if (!setjmp(env)) {
+            write_output(output_path_of(input), asm_code, asm_size);
+        } else {
+            ok = false;
+        }
+        bailout = NULL;
+    }
+    free(asm_code);
+    return ok;
+}
 
-    // Make sure that the file ends with a new line.
-    if (size == 0 || buff[size - 1] != '\n') {
-        buff[size++] = '\n';
+// Compile inputs one after another until none is left.
+void *worker(void *arg) {
+    for (;;) {
+        pthread_mutex_lock(&next_input_lock);
+        int i = next_input++;
+        pthread_mutex_unlock(&next_input_lock);
+        if (i >= inputs->len) {
+            return NULL;
+        }
+        if (!compile_input(vec_at(inputs, i))) {
+            pthread_mutex_lock(&next_input_lock);
+            failed = true;
+            pthread_mutex_unlock(&next_input_lock);
+        }
     }
-    buff[size] = '\0';
-    return buff;
 }
 
 int main(int argc, char **argv) {
-    if (argc == 1) {
-        usage();
+    parse_args(argc, argv);
+    if (server_path) {
+        serve(server_path, num_jobs, cache_dir);
+    }
+
+    // The main thread is one of the workers.
+    int num_threads = num_jobs < inputs->len ? num_jobs : inputs->len;
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, worker, NULL)) {
+            error("cannot create a thread");
+        }
+    }
+    worker(NULL);
+    for (int i = 1; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
     }
-    file_name = argv[1];
-    user_input = read_file(file_name);
-    ctok = tokenize();
-    ctok = preprocess(ctok);
-    Prog *prog = parse();
-    prog = assign_type(prog);
-    // draw_ast(prog);
-    codegen(prog);
-    return 0;
+    return failed;
 }
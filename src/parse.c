@@ -1,32 +1,11 @@
 #include "10cc.h"
 
 typedef struct Scope Scope;
-typedef struct VarScope VarScope;
-typedef struct TagScope TagScope;
 typedef struct InitVal InitVal;
 
 struct Scope {
-    VarScope *var_scope;
-    TagScope *tag_scope;
-};
-
-struct VarScope {
-    VarScope *next;
-    char *name;
-    int depth;
-
-    Var *var;
-    Type *type_def;
-    Type *enum_type;
-    int enum_val;
-};
-
-struct TagScope {
-    TagScope *next;
-    char *name;
-    int depth;
-
-    Type *type;
+    int var_log_len;  // Length of cc->var_log when the scope was entered
+    int tag_log_len;  // Length of cc->tag_log when the scope was entered
 };
 
 struct InitVal {
@@ -34,15 +13,6 @@ struct InitVal {
     Node *val;
 };
 
-Prog *prog;  // The program
-Func *fn;    // The function being parsed
-
-VarScope *var_scope;
-TagScope *tag_scope;
-int scope_depth;
-
-int str_label_cnt;
-
 Func *find_func(char *name);
 
 Var *new_var(Type *type, char *name, bool is_local, Token *tok);
@@ -50,9 +20,6 @@ Var *new_gvar(Type *type, char *name, Token *tok);
 Var *new_lvar(Type *type, char *name, Token *tok);
 Var *new_strl(char *str, Token *tok);
 
-VarScope *push_var_scope(char *name);
-TagScope *push_tag_scope(char *name);
-
 Var *push_var(char *name, Var *var);
 VarScope *find_var(char *name);
 
@@ -76,6 +43,7 @@ Type *read_base_type();
 Type *read_type_postfix(Type *type);
 Type *struct_decl();
 Type *enum_specifier();
+Token *typedef_decl();
 Node *decl();
 
 InitVal *read_lvar_init_val(Type *type);
@@ -97,7 +65,7 @@ Node *inc();
 Node *dec();
 
 // Find a function by name.
-Func *find_func(char *name) { return map_contains(prog->fns, name) ? map_at(prog->fns, name) : NULL; }
+Func *find_func(char *name) { return map_find(cc->prog->fns, name); }
 
 // Create a variable.
 Var *new_var(Type *type, char *name, bool is_local, Token *tok) {
@@ -113,7 +81,7 @@ Var *new_var(Type *type, char *name, bool is_local, Token *tok) {
             error_at(tok->loc, "declaration of '%s' as array of voids", tok->str);
         }
     }
-    Var *var = calloc(1, sizeof(Var));
+    Var *var = arena_alloc(&cc->ast_arena, sizeof(Var), AK_VAR);
     var->type = type;
     var->name = name;
     var->is_local = is_local;
@@ -135,64 +103,59 @@ Var *new_gvar(Type *type, char *name, Token *tok) {
 
 // Create a local variable, and registers it to the function.
 Var *new_lvar(Type *type, char *name, Token *tok) {
-    for (VarScope *sc = var_scope; sc; sc = sc->next) {
-        if (sc->depth != scope_depth) {
-            break;
-        }
-        if (!strcmp(name, sc->name)) {
-            error_at(tok->loc, "redeclaration of '%s'", tok->str);
-        }
+    VarScope *sc = map_find(cc->var_scope, name);
+    if (sc && sc->depth == cc->scope_depth) {
+        error_at(tok->loc, "redeclaration of '%s'", tok->str);
     }
     return push_var(name, new_var(type, name, true, tok));
 }
 
-// Create a string literal.
+// Create a string literal. It is numbered per function so that the code of a function does not depend on others.
 Var *new_strl(char *str, Token *tok) {
     Type *type = ary_of(char_type(), strlen(str) + 1);
-    char *name = format(".Lstr%d", str_label_cnt++);
+    char *name = format(".Lstr.%s.%d", cc->fn->name, cc->str_label_cnt++);
     Var *var = new_var(type, name, false, tok);
     var->data = tok->str;
-    return push_var(name, var);
+    vec_push(cc->fn->strs, var);  // String literals are referred to only by the node that defines them.
+    return var;
 }
 
 // Push a variable scope.
 VarScope *push_var_scope(char *name) {
-    VarScope *sc = calloc(1, sizeof(VarScope));
-    sc->next = var_scope;
+    VarScope *sc = arena_alloc(&cc->ast_arena, sizeof(VarScope), AK_SCOPE);
+    sc->next = map_find(cc->var_scope, name);
     sc->name = name;
-    sc->depth = scope_depth;
-    var_scope = sc;
+    sc->depth = cc->scope_depth;
+    map_insert(cc->var_scope, name, sc);
+    vec_push(cc->var_log, sc);
     return sc;
 }
 
-// Push a tag cope.
+// Push a tag scope.
 TagScope *push_tag_scope(char *name) {
-    TagScope *sc = calloc(1, sizeof(TagScope));
-    sc->next = tag_scope;
+    TagScope *sc = arena_alloc(&cc->ast_arena, sizeof(TagScope), AK_SCOPE);
+    sc->next = map_find(cc->tag_scope, name);
     sc->name = name;
-    sc->depth = scope_depth;
-    tag_scope = sc;
+    sc->depth = cc->scope_depth;
+    map_insert(cc->tag_scope, name, sc);
+    vec_push(cc->tag_log, sc);
     return sc;
 }
 
 // Push a variable to the current scope.
 Var *push_var(char *name, Var *var) {
     push_var_scope(name)->var = var;
-    vec_push(var->is_local ? fn->lvars : prog->gvars, var);
+    vec_push(var->is_local ? cc->fn->lvars : cc->prog->gvars, var);
     return var;
 }
 
-// Find a variable by name.
+// Find a variable by name, which must be interned.
 VarScope *find_var(char *name) {
-    for (VarScope *sc = var_scope; sc; sc = sc->next) {
-        if (!strcmp(name, sc->name)) {
-            if (!sc->var && !sc->enum_type) {
-                error_at(ctok->loc, "unexpected variable name '%s'", name);
-            }
-            return sc;
-        }
+    VarScope *sc = map_find(cc->var_scope, name);
+    if (sc && !sc->var && !sc->enum_type) {
+        error_at(cc->ctok->loc, "unexpected variable name '%s'", name);
     }
-    return NULL;
+    return sc;
 }
 
 // Push a typedef to the current scope.
@@ -201,14 +164,10 @@ Type *push_typedef(char *name, Type *type) {
     return type;
 }
 
-// Find a typedef by name.
+// Find a typedef by name, which must be interned.
 Type *find_typedef(char *name) {
-    for (VarScope *sc = var_scope; sc; sc = sc->next) {
-        if (!strcmp(name, sc->name)) {
-            return sc->type_def;
-        }
-    }
-    return NULL;
+    VarScope *sc = map_find(cc->var_scope, name);
+    return sc ? sc->type_def : NULL;
 }
 
 // Push a tag to the current scope.
@@ -217,41 +176,43 @@ Type *push_tag(char *name, Type *type) {
     return type;
 }
 
-// Find a type by name.
+// Find a type by name, which must be interned.
 Type *find_tag(char *name) {
-    for (TagScope *sc = tag_scope; sc; sc = sc->next) {
-        if (!strcmp(name, sc->name)) {
-            return sc->type;
-        }
-    }
-    return NULL;
+    TagScope *sc = map_find(cc->tag_scope, name);
+    return sc ? sc->type : NULL;
 }
 
 // Enter a new scope.
 Scope *enter_scope() {
-    Scope *sc = calloc(1, sizeof(Scope));
-    sc->var_scope = var_scope;
-    sc->tag_scope = tag_scope;
-    scope_depth++;
+    Scope *sc = arena_alloc(&cc->ast_arena, sizeof(Scope), AK_SCOPE);
+    sc->var_log_len = cc->var_log->len;
+    sc->tag_log_len = cc->tag_log->len;
+    cc->scope_depth++;
     return sc;
 }
 
-// Leave the current scope.
+// Leave the current scope, restoring the bindings shadowed by the ones pushed since the scope was entered.
 void leave_scope(Scope *sc) {
-    var_scope = sc->var_scope;
-    tag_scope = sc->tag_scope;
-    scope_depth--;
+    while (cc->var_log->len > sc->var_log_len) {
+        VarScope *vs = cc->var_log->data[--cc->var_log->len];
+        map_insert(cc->var_scope, vs->name, vs->next);
+    }
+    while (cc->tag_log->len > sc->tag_log_len) {
+        TagScope *ts = cc->tag_log->data[--cc->tag_log->len];
+        map_insert(cc->tag_scope, ts->name, ts->next);
+    }
+    cc->scope_depth--;
 }
 
 // Return true if the kind of the current token is a type name.
 bool at_typename() {
-    char *typenames[] = {"void", "_Bool", "char", "short", "int", "long", "struct", "typedef", "enum"};
+    ReservedId typenames[] = {KW_VOID, KW_BOOL, KW_CHAR, KW_SHORT, KW_INT, KW_LONG, KW_STRUCT, KW_TYPEDEF, KW_ENUM};
     for (int i = 0; i < sizeof(typenames) / sizeof(typenames[0]); i++) {
-        if (peek(TK_RESERVED, typenames[i])) {
+        if (peek_id(typenames[i])) {
             return true;
         }
     }
-    Token *tok = peek(TK_IDENT, NULL);
+    Token *tok = peek(TK_IDENT);
     if (tok && find_typedef(tok->str)) {
         return true;
     }
@@ -260,7 +221,8 @@ bool at_typename() {
 
 // Create a node.
 Node *new_node(NodeKind kind, Token *tok) {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_alloc(&cc->ast_arena, sizeof(Node), AK_NODE);
+    cc->num_nodes++;
     node->kind = kind;
     node->tok = tok;
     return node;
@@ -300,29 +262,29 @@ Node *new_node_varref(Var *var, Token *tok) {
 // T = ("int" | "char" | "void" | struct-decl | typedef-name) "*"*
 Type *read_base_type() {
     Type *type;
-    if (consume(TK_RESERVED, "void")) {
+    if (consume_id(KW_VOID)) {
         type = void_type();
-    } else if (consume(TK_RESERVED, "_Bool")) {
+    } else if (consume_id(KW_BOOL)) {
         type = bool_type();
-    } else if (consume(TK_RESERVED, "char")) {
+    } else if (consume_id(KW_CHAR)) {
         type = char_type();
-    } else if (consume(TK_RESERVED, "short")) {
+    } else if (consume_id(KW_SHORT)) {
         type = short_type();
-    } else if (consume(TK_RESERVED, "int")) {
+    } else if (consume_id(KW_INT)) {
         type = int_type();
-    } else if (consume(TK_RESERVED, "long")) {
+    } else if (consume_id(KW_LONG)) {
         type = long_type();
-    } else if (peek(TK_RESERVED, "struct")) {
+    } else if (peek_id(KW_STRUCT)) {
         type = struct_decl();
-    } else if (peek(TK_RESERVED, "enum")) {
+    } else if (peek_id(KW_ENUM)) {
         type = enum_specifier();
     } else {
-        type = find_typedef(expect(TK_IDENT, NULL)->str);
+        type = find_typedef(expect(TK_IDENT)->str);
     }
     if (!type) {
-        error_at(ctok->loc, "unknown type name '%s'", ctok->str);
+        error_at(cc->ctok->loc, "unknown type name '%s'", cc->ctok->str);
     }
-    while ((consume(TK_RESERVED, "*"))) {
+    while ((consume_id(PU_STAR))) {
         type = ptr_to(type);
     }
     return type;
@@ -330,33 +292,33 @@ Type *read_base_type() {
 
 // type-postfix = ("[" num? "]")*
 Type *read_type_postfix(Type *base) {
-    if (!consume(TK_RESERVED, "[")) {
+    if (!consume_id(PU_LBRACKET)) {
         return base;
     }
-    Token *tok = consume(TK_NUM, NULL);
+    Token *tok = consume(TK_NUM);
     int size = tok ? tok->val : -1;
-    expect(TK_RESERVED, "]");
+    expect_id(PU_RBRACKET);
     base = read_type_postfix(base);
     return ary_of(base, size);
 }
 
 // struct-member = type ident ("[" num "]")* ";"
 Member *struct_member() {
-    Member *mem = calloc(1, sizeof(Member));
+    Member *mem = arena_alloc(&cc->ast_arena, sizeof(Member), AK_MEMBER);
     mem->type = read_base_type();
-    mem->name = expect(TK_IDENT, NULL)->str;
+    mem->name = expect(TK_IDENT)->str;
     mem->type = read_type_postfix(mem->type);
-    expect(TK_RESERVED, ";");
+    expect_id(PU_SEMICOLON);
     return mem;
 }
 
 // struct-decl = "struct" ident
 //             | "struct" ident? "{" struct-member* "}"
 Type *struct_decl() {
-    expect(TK_RESERVED, "struct");
+    expect_id(KW_STRUCT);
 
-    Token *tok = consume(TK_IDENT, NULL);
-    if (tok && !peek(TK_RESERVED, "{")) {
+    Token *tok = consume(TK_IDENT);
+    if (tok && !peek_id(PU_LBRACE)) {
         Type *type = find_tag(tok->str);
         if (!type) {
             error_at(tok->loc, "undefined struct '%s'", tok->str);
@@ -366,11 +328,11 @@ Type *struct_decl() {
 
     Map *members = map_create();
     int offset = 0;
-    expect(TK_RESERVED, "{");
-    while (!consume(TK_RESERVED, "}")) {
+    expect_id(PU_LBRACE);
+    while (!consume_id(PU_RBRACE)) {
         Member *mem = struct_member();
         if (map_contains(members, mem->name)) {
-            error_at(ctok->loc, "duplicate member '%s'", mem->name);
+            error_at(cc->ctok->loc, "duplicate member '%s'", mem->name);
         }
         mem->offset = offset;
         offset += mem->type->size;
@@ -390,13 +352,13 @@ Type *struct_decl() {
 //           | "enum" ident? "{" enum-list? "}"
 // enum-list = ident ("=" num)? ("," ident ("=" num)?)* ","?
 Type *enum_specifier() {
-    expect(TK_RESERVED, "enum");
+    expect_id(KW_ENUM);
 
     Type *type = enum_type();
 
-    Token *tok = consume(TK_IDENT, NULL);
+    Token *tok = consume(TK_IDENT);
     char *tag_name = tok ? tok->str : NULL;
-    if (tok && !peek(TK_RESERVED, "{")) {
+    if (tok && !peek_id(PU_LBRACE)) {
         type = find_tag(tag_name);
         if (!type || type->kind != TY_ENUM) {
             error_at(tok->loc, "undefined enum '%s'", tok->str);
@@ -405,16 +367,16 @@ Type *enum_specifier() {
     }
 
     int enum_val = 0;
-    expect(TK_RESERVED, "{");
-    while (!consume(TK_RESERVED, "}")) {
-        tok = consume(TK_IDENT, NULL);
-        if ((consume(TK_RESERVED, "="))) {
-            enum_val = expect(TK_NUM, NULL)->val;
+    expect_id(PU_LBRACE);
+    while (!consume_id(PU_RBRACE)) {
+        tok = consume(TK_IDENT);
+        if ((consume_id(PU_ASSIGN))) {
+            enum_val = expect(TK_NUM)->val;
         }
         VarScope *sc = push_var_scope(tok->str);
         sc->enum_type = type;
         sc->enum_val = enum_val++;
-        consume(TK_RESERVED, ",");
+        consume_id(PU_COMMA);
     }
 
     if (tag_name) {
@@ -426,32 +388,32 @@ Type *enum_specifier() {
 
 // Read initial values.
 InitVal *read_lvar_init_val(Type *type) {
-    InitVal *iv = calloc(1, sizeof(InitVal));
+    InitVal *iv = arena_alloc(&cc->ast_arena, sizeof(InitVal), AK_NODE);
     Token *tok;
     switch (type->kind) {
         case TY_ARY:
             iv->vals = vec_create();
-            if (consume(TK_RESERVED, "{")) {
-                while (!consume(TK_RESERVED, "}")) {
+            if (consume_id(PU_LBRACE)) {
+                while (!consume_id(PU_RBRACE)) {
                     if (iv->vals->len > 0) {
-                        expect(TK_RESERVED, ",");
+                        expect_id(PU_COMMA);
                     }
                     vec_push(iv->vals, read_lvar_init_val(type->base));
                 }
                 break;
             }
-            if ((tok = consume(TK_STR, NULL))) {
+            if ((tok = consume(TK_STR))) {
                 for (int i = 0; i < strlen(tok->str); i++) {
-                    InitVal *v = calloc(1, sizeof(InitVal));
+                    InitVal *v = arena_alloc(&cc->ast_arena, sizeof(InitVal), AK_NODE);
                     v->val = new_node_num(tok->str[i], NULL);
                     vec_push(iv->vals, v);
                 }
-                InitVal *v = calloc(1, sizeof(InitVal));
+                InitVal *v = arena_alloc(&cc->ast_arena, sizeof(InitVal), AK_NODE);
                 v->val = new_node_num('\0', NULL);
                 vec_push(iv->vals, v);
                 break;
             }
-            error_at(ctok->loc, "expected expression before '%s'", ctok->str);
+            error_at(cc->ctok->loc, "expected expression before '%s'", cc->ctok->str);
         default:
             iv->val = assign();
             break;
@@ -469,14 +431,10 @@ Node *lvar_init(Type *type, Node *node, InitVal *iv, Token *tok) {
             node_i = new_node_uniop(ND_DEREF, node_i, NULL);
             vec_push(initializer->stmts, lvar_init(type->base, node_i, vec_at(iv->vals, i), tok));
         }
-        if (type->array_size == -1) {
-            type->array_size = iv->vals->len;
-            type->size = type->base->size * type->array_size;
-        }
         for (int i = iv->vals->len; i < type->array_size; i++) {
             Node *node_i = new_node_binop(ND_ADD, node, new_node_num(i, NULL), NULL);
             node_i = new_node_uniop(ND_DEREF, node_i, NULL);
-            InitVal *iv = calloc(1, sizeof(InitVal));
+            InitVal *iv = arena_alloc(&cc->ast_arena, sizeof(InitVal), AK_NODE);
             iv->val = new_node_num(0, NULL);
             vec_push(initializer->stmts, lvar_init(type->base, node_i, iv, tok));
         }
@@ -495,42 +453,51 @@ Node *lvar_init(Type *type, Node *node, InitVal *iv, Token *tok) {
 Node *decl() {
     Token *tok;
 
-    if ((tok = consume(TK_RESERVED, "typedef"))) {
-        Type *type = read_base_type();
-        tok = consume(TK_IDENT, NULL);
-        type = read_type_postfix(type);
-        expect(TK_RESERVED, ";");
-        push_typedef(tok->str, type);
-        return new_node(ND_NULL, tok);
+    if (peek_id(KW_TYPEDEF)) {
+        return new_node(ND_NULL, typedef_decl());
     }
 
     Type *type = read_base_type();
 
-    if (consume(TK_RESERVED, ";")) {
+    if (consume_id(PU_SEMICOLON)) {
         return new_node(ND_NULL, NULL);
     }
 
-    tok = expect(TK_IDENT, NULL);
+    tok = expect(TK_IDENT);
     type = read_type_postfix(type);
     Var *var = new_lvar(type, tok->str, tok);
 
-    if (consume(TK_RESERVED, ";")) {
+    if (consume_id(PU_SEMICOLON)) {
         return new_node(ND_NULL, NULL);
     }
 
-    tok = expect(TK_RESERVED, "=");
+    tok = expect_id(PU_ASSIGN);
     InitVal *iv = read_lvar_init_val(var->type);
-    expect(TK_RESERVED, ";");
+    expect_id(PU_SEMICOLON);
+    if (var->type->kind == TY_ARY && var->type->array_size == -1) {
+        var->type = ary_of(var->type->base, iv->vals->len);  // Complete the array type with the initializer.
+    }
     return lvar_init(var->type, new_node_varref(var, tok), iv, tok);
 }
 
+// typedef = "typedef" T ident ("[" num "]")* ";"
+Token *typedef_decl() {
+    expect_id(KW_TYPEDEF);
+    Type *type = read_base_type();
+    Token *tok = expect(TK_IDENT);
+    type = read_type_postfix(type);
+    expect_id(PU_SEMICOLON);
+    push_typedef(tok->str, type);
+    return tok;
+}
+
 // compound-stmt = "{" stmt* "}"
 Node *compound_stmt() {
-    Node *node = new_node(ND_BLOCK, ctok);
+    Node *node = new_node(ND_BLOCK, cc->ctok);
     Scope *sc = enter_scope();
     node->stmts = vec_create();
-    expect(TK_RESERVED, "{");
-    while (!consume(TK_RESERVED, "}")) {
+    expect_id(PU_LBRACE);
+    while (!consume_id(PU_RBRACE)) {
         vec_push(node->stmts, stmt());
     }
     leave_scope(sc);
@@ -539,21 +506,21 @@ Node *compound_stmt() {
 
 // expr-stmt = expr ";"
 Node *expr_stmt() {
-    Node *node = new_node_uniop(ND_EXPR_STMT, expr(), ctok);
-    expect(TK_RESERVED, ";");
+    Node *node = new_node_uniop(ND_EXPR_STMT, expr(), cc->ctok);
+    expect_id(PU_SEMICOLON);
     return node;
 }
 
 // selection-stmt = "if" "(" expr ")" stmt ("else" stmt)?
 Node *selection_stmt() {
     Token *tok;
-    if ((tok = consume(TK_RESERVED, "if"))) {
+    if ((tok = consume_id(KW_IF))) {
         Node *node = new_node(ND_IF, tok);
-        expect(TK_RESERVED, "(");
+        expect_id(PU_LPAREN);
         node->cond = expr();
-        expect(TK_RESERVED, ")");
+        expect_id(PU_RPAREN);
         node->then = stmt();
-        node->els = consume(TK_RESERVED, "else") ? stmt() : new_node(ND_NULL, NULL);
+        node->els = consume_id(KW_ELSE) ? stmt() : new_node(ND_NULL, NULL);
         return node;
     }
 
@@ -565,27 +532,27 @@ Node *selection_stmt() {
 //                | "for" "(" decl? ";" expr? ";" expr? ")" stmt
 Node *iteration_stmt() {
     Token *tok;
-    if ((tok = consume(TK_RESERVED, "while"))) {
+    if ((tok = consume_id(KW_WHILE))) {
         Node *node = new_node(ND_WHILE, tok);
-        expect(TK_RESERVED, "(");
+        expect_id(PU_LPAREN);
         node->cond = expr();
-        expect(TK_RESERVED, ")");
+        expect_id(PU_RPAREN);
         node->then = stmt();
         return node;
     }
-    if ((tok = consume(TK_RESERVED, "for"))) {
+    if ((tok = consume_id(KW_FOR))) {
         Node *node = new_node(ND_FOR, tok);
         Scope *sc = enter_scope();
-        expect(TK_RESERVED, "(");
-        if (consume(TK_RESERVED, ";")) {
+        expect_id(PU_LPAREN);
+        if (consume_id(PU_SEMICOLON)) {
             node->init = new_node(ND_NULL, NULL);
         } else {
             node->init = at_typename() ? decl() : expr_stmt();
         }
-        node->cond = peek(TK_RESERVED, ";") ? new_node_num(1, NULL) : expr();
-        expect(TK_RESERVED, ";");
-        node->upd = peek(TK_RESERVED, ")") ? new_node(ND_NULL, NULL) : new_node_uniop(ND_EXPR_STMT, expr(), ctok);
-        expect(TK_RESERVED, ")");
+        node->cond = peek_id(PU_SEMICOLON) ? new_node_num(1, NULL) : expr();
+        expect_id(PU_SEMICOLON);
+        node->upd = peek_id(PU_RPAREN) ? new_node(ND_NULL, NULL) : new_node_uniop(ND_EXPR_STMT, expr(), cc->ctok);
+        expect_id(PU_RPAREN);
         node->then = stmt();
         leave_scope(sc);
         return node;
@@ -598,17 +565,17 @@ Node *iteration_stmt() {
 //           | "return" expr? ";"
 Node *jump_stmt() {
     Token *tok;
-    if ((tok = consume(TK_RESERVED, "continue"))) {
-        expect(TK_RESERVED, ";");
+    if ((tok = consume_id(KW_CONTINUE))) {
+        expect_id(PU_SEMICOLON);
         return new_node(ND_CONTINUE, tok);
     }
-    if ((tok = consume(TK_RESERVED, "break"))) {
-        expect(TK_RESERVED, ";");
+    if ((tok = consume_id(KW_BREAK))) {
+        expect_id(PU_SEMICOLON);
         return new_node(ND_BREAK, tok);
     }
-    if ((tok = expect(TK_RESERVED, "return"))) {
+    if ((tok = expect_id(KW_RETURN))) {
         Node *node = new_node_uniop(ND_RETURN, expr(), tok);
-        expect(TK_RESERVED, ";");
+        expect_id(PU_SEMICOLON);
         return node;
     }
     return NULL;
@@ -623,22 +590,22 @@ Node *jump_stmt() {
 //      | ";"
 Node *stmt() {
     Token *tok;
-    if (peek(TK_RESERVED, "{")) {
+    if (peek_id(PU_LBRACE)) {
         return compound_stmt();
     }
-    if (peek(TK_RESERVED, "if")) {
+    if (peek_id(KW_IF)) {
         return selection_stmt();
     }
-    if (peek(TK_RESERVED, "for") || peek(TK_RESERVED, "while")) {
+    if (peek_id(KW_FOR) || peek_id(KW_WHILE)) {
         return iteration_stmt();
     }
-    if (peek(TK_RESERVED, "continue") || peek(TK_RESERVED, "break") || peek(TK_RESERVED, "return")) {
+    if (peek_id(KW_CONTINUE) || peek_id(KW_BREAK) || peek_id(KW_RETURN)) {
         return jump_stmt();
     }
     if (at_typename()) {
         return decl();
     }
-    if ((tok = consume(TK_RESERVED, ";"))) {
+    if ((tok = consume_id(PU_SEMICOLON))) {
         return new_node(ND_NULL, tok);
     }
     return expr_stmt();
@@ -648,7 +615,7 @@ Node *stmt() {
 Node *expr() {
     Node *node = assign();
     Token *tok;
-    while ((tok = consume(TK_RESERVED, ","))) {
+    while ((tok = consume_id(PU_COMMA))) {
         node = new_node_uniop(ND_EXPR_STMT, node, node->tok);
         node = new_node_binop(ND_COMMA, node, assign(), tok);
     }
@@ -660,19 +627,19 @@ Node *expr() {
 Node *assign() {
     Node *node = conditional();
     Token *tok;
-    if ((tok = consume(TK_RESERVED, "="))) {
+    if ((tok = consume_id(PU_ASSIGN))) {
         return new_node_binop(ND_ASSIGN, node, assign(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "+="))) {
+    if ((tok = consume_id(PU_ADD_ASSIGN))) {
         return new_node_binop(ND_ASSIGN, node, new_node_binop(ND_ADD, node, assign(), tok), tok);
     }
-    if ((tok = consume(TK_RESERVED, "-="))) {
+    if ((tok = consume_id(PU_SUB_ASSIGN))) {
         return new_node_binop(ND_ASSIGN, node, new_node_binop(ND_SUB, node, assign(), tok), tok);
     }
-    if ((tok = consume(TK_RESERVED, "*="))) {
+    if ((tok = consume_id(PU_MUL_ASSIGN))) {
         return new_node_binop(ND_ASSIGN, node, new_node_binop(ND_MUL, node, assign(), tok), tok);
     }
-    if ((tok = consume(TK_RESERVED, "/="))) {
+    if ((tok = consume_id(PU_DIV_ASSIGN))) {
         return new_node_binop(ND_ASSIGN, node, new_node_binop(ND_DIV, node, assign(), tok), tok);
     }
     return node;
@@ -682,7 +649,7 @@ Node *assign() {
 Node *conditional() {
     Node *node = equality();
 
-    Token *tok = consume(TK_RESERVED, "?");
+    Token *tok = consume_id(PU_QUESTION);
     if (!tok) {
         return node;
     }
@@ -690,7 +657,7 @@ Node *conditional() {
     Node *ternary = new_node(ND_TERNARY, tok);
     ternary->cond = node;
     ternary->then = expr();
-    expect(TK_RESERVED, ":");
+    expect_id(PU_COLON);
     ternary->els = conditional();
     return ternary;
 }
@@ -700,11 +667,11 @@ Node *equality() {
     Node *node = relational();
     Token *tok;
     for (;;) {
-        if ((tok = consume(TK_RESERVED, "=="))) {
+        if ((tok = consume_id(PU_EQ))) {
             node = new_node_binop(ND_EQ, node, relational(), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "!="))) {
+        if ((tok = consume_id(PU_NE))) {
             node = new_node_binop(ND_NE, node, relational(), tok);
             continue;
         }
@@ -719,19 +686,19 @@ Node *relational() {
     Node *node = add();
     Token *tok;
     for (;;) {
-        if ((tok = consume(TK_RESERVED, "<="))) {
+        if ((tok = consume_id(PU_LE))) {
             node = new_node_binop(ND_LE, node, relational(), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, ">="))) {
+        if ((tok = consume_id(PU_GE))) {
             node = new_node_binop(ND_LE, relational(), node, tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "<"))) {
+        if ((tok = consume_id(PU_LT))) {
             node = new_node_binop(ND_LT, node, relational(), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, ">"))) {
+        if ((tok = consume_id(PU_GT))) {
             node = new_node_binop(ND_LT, relational(), node, tok);
             continue;
         }
@@ -744,11 +711,11 @@ Node *add() {
     Node *node = mul();
     Token *tok;
     for (;;) {
-        if ((tok = consume(TK_RESERVED, "+"))) {
+        if ((tok = consume_id(PU_PLUS))) {
             node = new_node_binop(ND_ADD, node, mul(), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "-"))) {
+        if ((tok = consume_id(PU_MINUS))) {
             node = new_node_binop(ND_SUB, node, mul(), tok);
             continue;
         }
@@ -761,11 +728,11 @@ Node *mul() {
     Node *node = unary();
     Token *tok;
     for (;;) {
-        if ((tok = consume(TK_RESERVED, "*"))) {
+        if ((tok = consume_id(PU_STAR))) {
             node = new_node_binop(ND_MUL, node, unary(), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "/"))) {
+        if ((tok = consume_id(PU_SLASH))) {
             node = new_node_binop(ND_DIV, node, unary(), tok);
             continue;
         }
@@ -780,38 +747,38 @@ Node *mul() {
 // unary-operator = "++" | "--" | "+" | "-" | "&" | "*" | "!"
 Node *unary() {
     Token *tok;
-    if ((tok = consume(TK_RESERVED, "++"))) {
+    if ((tok = consume_id(PU_INC))) {
         return inc(unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "--"))) {
+    if ((tok = consume_id(PU_DEC))) {
         return dec(unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "+"))) {
+    if ((tok = consume_id(PU_PLUS))) {
         return unary();
     }
-    if ((tok = consume(TK_RESERVED, "-"))) {
+    if ((tok = consume_id(PU_MINUS))) {
         return new_node_binop(ND_SUB, new_node_num(0, NULL), unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "&"))) {
+    if ((tok = consume_id(PU_AMP))) {
         return new_node_uniop(ND_ADDR, unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "*"))) {
+    if ((tok = consume_id(PU_STAR))) {
         return new_node_uniop(ND_DEREF, unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "!"))) {
+    if ((tok = consume_id(PU_NOT))) {
         return new_node_uniop(ND_NOT, unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "~"))) {
+    if ((tok = consume_id(PU_TILDE))) {
         return new_node_uniop(ND_BITNOT, unary(), tok);
     }
-    if ((tok = consume(TK_RESERVED, "sizeof"))) {
-        if (consume(TK_RESERVED, "(")) {
+    if ((tok = consume_id(KW_SIZEOF))) {
+        if (consume_id(PU_LPAREN)) {
             if (at_typename()) {
                 Node *node = new_node_num(read_base_type()->size, tok);
-                expect(TK_RESERVED, ")");
+                expect_id(PU_RPAREN);
                 return node;
             }
-            ctok = tok->next;
+            cc->ctok = tok->next;
         }
         return new_node_uniop(ND_SIZEOF, unary(), tok);
     }
@@ -824,27 +791,27 @@ Node *postfix() {
     Node *node = primary();
     Token *tok;
     for (;;) {
-        if ((tok = consume(TK_RESERVED, "["))) {
+        if ((tok = consume_id(PU_LBRACKET))) {
             node = new_node_uniop(ND_DEREF, new_node_binop(ND_ADD, node, expr(), tok), tok);
-            expect(TK_RESERVED, "]");
+            expect_id(PU_RBRACKET);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "."))) {
+        if ((tok = consume_id(PU_DOT))) {
             node = new_node_uniop(ND_MEMBER, node, tok);
-            node->member_name = expect(TK_IDENT, NULL)->str;
+            node->member_name = expect(TK_IDENT)->str;
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "->"))) {
+        if ((tok = consume_id(PU_ARROW))) {
             node = new_node_uniop(ND_DEREF, node, tok);
             node = new_node_uniop(ND_MEMBER, node, tok);
-            node->member_name = expect(TK_IDENT, NULL)->str;
+            node->member_name = expect(TK_IDENT)->str;
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "++"))) {
+        if ((tok = consume_id(PU_INC))) {
             node = new_node_binop(ND_SUB, inc(node, tok), new_node_num(1, tok), tok);
             continue;
         }
-        if ((tok = consume(TK_RESERVED, "--"))) {
+        if ((tok = consume_id(PU_DEC))) {
             node = new_node_binop(ND_ADD, dec(node, tok), new_node_num(1, tok), tok);
             continue;
         }
@@ -855,10 +822,10 @@ Node *postfix() {
 // args = "(" (expr ("," expr)*)? ")"
 Vector *args() {
     Vector *args = vec_create();
-    expect(TK_RESERVED, "(");
-    while (!consume(TK_RESERVED, ")")) {
+    expect_id(PU_LPAREN);
+    while (!consume_id(PU_RPAREN)) {
         if (args->len > 0) {
-            expect(TK_RESERVED, ",");
+            expect_id(PU_COMMA);
         }
         vec_push(args, assign());
     }
@@ -867,7 +834,7 @@ Vector *args() {
 
 // call = ident args
 Node *call() {
-    Token *tok = expect(TK_IDENT, NULL);
+    Token *tok = expect(TK_IDENT);
     Func *fn_ = find_func(tok->str);
     if (!fn_) {
         error_at(tok->loc, "undefined reference to `%s'", tok->str);
@@ -881,11 +848,11 @@ Node *call() {
 
 // stmt-expr = "(" "{" stmt+ "}" ")"
 Node *stmt_expr() {
-    Node *node = new_node(ND_STMT_EXPR, ctok);
+    Node *node = new_node(ND_STMT_EXPR, cc->ctok);
 
-    expect(TK_RESERVED, "(");
+    expect_id(PU_LPAREN);
     node->stmts = compound_stmt()->stmts;
-    expect(TK_RESERVED, ")");
+    expect_id(PU_RPAREN);
 
     if (node->stmts->len == 0) {
         error_at(node->tok->loc, "void value not ignored as it ought to be");
@@ -899,16 +866,16 @@ Node *stmt_expr() {
 }
 
 bool at_call() {
-    Token *tok = ctok;
-    bool at_call = consume(TK_IDENT, NULL) && consume(TK_RESERVED, "(");
-    ctok = tok;
+    Token *tok = cc->ctok;
+    bool at_call = consume(TK_IDENT) && consume_id(PU_LPAREN);
+    cc->ctok = tok;
     return at_call;
 }
 
 bool at_stmt_expr() {
-    Token *tok = ctok;
-    bool at_stmt_expr = consume(TK_RESERVED, "(") && consume(TK_RESERVED, "{");
-    ctok = tok;
+    Token *tok = cc->ctok;
+    bool at_stmt_expr = consume_id(PU_LPAREN) && consume_id(PU_LBRACE);
+    cc->ctok = tok;
     return at_stmt_expr;
 }
 
@@ -923,7 +890,7 @@ Node *primary() {
         return call();
     }
     Token *tok;
-    if ((tok = consume(TK_IDENT, NULL))) {
+    if ((tok = consume(TK_IDENT))) {
         VarScope *sc = find_var(tok->str);
         if (!sc) {
             error_at(tok->loc, "'%s' undeclared", tok->str);
@@ -935,18 +902,18 @@ Node *primary() {
             return new_node_num(sc->enum_val, tok);
         }
     }
-    if ((tok = consume(TK_NUM, NULL))) {
+    if ((tok = consume(TK_NUM))) {
         return new_node_num(tok->val, tok);
     }
-    if ((tok = consume(TK_STR, NULL))) {
+    if ((tok = consume(TK_STR))) {
         return new_node_varref(new_strl(tok->str, tok), tok);
     }
     if (at_stmt_expr()) {
         return stmt_expr();
     }
-    if ((tok = consume(TK_RESERVED, "("))) {
+    if ((tok = consume_id(PU_LPAREN))) {
         Node *node = expr();
-        expect(TK_RESERVED, ")");
+        expect_id(PU_RPAREN);
         return node;
     }
     return NULL;
@@ -965,7 +932,7 @@ Node *dec(Node *node, Token *tok) {
 // param = T ident ("[" num "]")*
 Var *param() {
     Type *type = read_base_type();
-    Token *tok = expect(TK_IDENT, NULL);
+    Token *tok = expect(TK_IDENT);
     type = read_type_postfix(type);
     return new_lvar(type, tok->str, tok);
 }
@@ -973,30 +940,98 @@ Var *param() {
 // params = "(" (param ("," param)*)? ")"
 Vector *params() {
     Vector *params = vec_create();
-    expect(TK_RESERVED, "(");
-    while (!consume(TK_RESERVED, ")")) {
+    expect_id(PU_LPAREN);
+    while (!consume_id(PU_RPAREN)) {
         if (params->len > 0) {
-            expect(TK_RESERVED, ",");
+            expect_id(PU_COMMA);
         }
         vec_push(params, param());
     }
     return params;
 }
 
+// Hash the declarations that the identifiers from start to end refer to in the current scope into h. The hash changes
+// when a global variable, typedef, enum constant, tag, or function used by the tokens changes.
+uint64_t hash_decls(uint64_t h, Token *start, Token *end) {
+    for (Token *tok = start; tok != end; tok = tok->next) {
+        if (tok->kind != TK_IDENT) {
+            continue;
+        }
+        h = hash64(h, tok->str, strlen(tok->str) + 1);
+        VarScope *sc = map_find(cc->var_scope, tok->str);
+        if (sc && sc->var) {
+            h = hash64(h, "v", 1);
+            h = hash64(h, &sc->var->is_local, sizeof(sc->var->is_local));
+            h = hash_type(h, sc->var->type);
+        } else if (sc && sc->type_def) {
+            h = hash_type(hash64(h, "t", 1), sc->type_def);
+        } else if (sc && sc->enum_type) {
+            h = hash64(hash64(h, "e", 1), &sc->enum_val, sizeof(sc->enum_val));
+        }
+        Func *fn = find_func(tok->str);
+        if (fn) {
+            h = hash_type(hash64(h, "f", 1), fn->rtype);
+            for (int i = 0; i < fn->params->len; i++) {
+                h = hash_type(h, ((Var *)vec_at(fn->params, i))->type);
+            }
+        }
+        TagScope *tag = map_find(cc->tag_scope, tok->str);
+        if (tag) {
+            h = hash_type(hash64(h, "s", 1), tag->type);
+        }
+    }
+    return h;
+}
+
+// Reuse the code of a function definition from the per-function cache, where start is the first token of the
+// definition and the current token is its "{". On a hit, the body is skipped, and true is returned. On a miss, the
+// key is recorded so that the generated code is stored later.
+bool reuse_func(Func *fn, Token *start) {
+    // Find the end of the body.
+    Token *end = cc->ctok;
+    for (int depth = 0;; end = end->next) {
+        if (end->kind == TK_EOF) {
+            return false;  // Let the parser report the error.
+        }
+        depth += end->kind == TK_RESERVED && end->id == PU_LBRACE;
+        depth -= end->kind == TK_RESERVED && end->id == PU_RBRACE;
+        if (depth == 0) {
+            break;
+        }
+    }
+    end = end->next;
+
+    fn->key = arena_alloc(&cc->ast_arena, sizeof(uint64_t) * 2, AK_FUNC);
+    cache_func_key(start, end, fn->key);
+    FuncCacheEntry *e = func_cache_find(cc->func_cache, fn->key);
+    if (!e) {
+        return false;
+    }
+    fn->code = e->code;
+    fn->code_size = e->size;
+    cc->ctok = end;
+    return true;
+}
+
 // func = T ident "(" params? ")" "{" stmt* "}"
 void func() {
+    double begin = trace_begin();
+    Token *start = cc->ctok;
     Scope *sc = enter_scope();
 
-    fn = calloc(1, sizeof(Func));
+    Func *fn = arena_alloc(&cc->ast_arena, sizeof(Func), AK_FUNC);
+    cc->fn = fn;
     fn->rtype = read_base_type();
-    fn->tok = expect(TK_IDENT, NULL);
+    fn->tok = expect(TK_IDENT);
     fn->name = fn->tok->str;
     fn->lvars = vec_create();
+    fn->strs = vec_create();
     fn->params = params();
+    cc->str_label_cnt = 0;
 
     Func *fn_ = find_func(fn->name);
     if (fn_) {
-        if (fn_->body) {
+        if (fn_->body || fn_->code) {
             error_at(fn->tok->loc, "redefinition of '%s'", fn->name);
         }
         if (!is_same_type(fn->rtype, fn_->rtype)) {
@@ -1013,34 +1048,42 @@ void func() {
             }
         }
     }
-    map_insert(prog->fns, fn->name, fn);
+    map_insert(cc->prog->fns, fn->name, fn);
 
-    if (!consume(TK_RESERVED, ";")) {
-        fn->body = compound_stmt();
+    if (!consume_id(PU_SEMICOLON)) {
+        if (!cc->incremental || !reuse_func(fn, start)) {
+            fn->body = compound_stmt();
+        }
+        trace_end(fn->name, "parse", begin);
     }
     leave_scope(sc);
 }
 
-// gvar = T ident ("[" num "]")* ";"
+// gvar = T (ident ("[" num "]")*)? ";"
 void gvar() {
     Type *type = read_base_type();
-    Token *tok = expect(TK_IDENT, NULL);
+    if (consume_id(PU_SEMICOLON)) {
+        return;  // A declaration of a struct or enum only
+    }
+    Token *tok = expect(TK_IDENT);
     type = read_type_postfix(type);
-    expect(TK_RESERVED, ";");
+    expect_id(PU_SEMICOLON);
     new_gvar(type, tok->str, tok);
 }
 
 bool at_func() {
-    Token *tok = ctok;
+    Token *tok = cc->ctok;
     read_base_type();
-    bool is_func = consume(TK_IDENT, NULL) && consume(TK_RESERVED, "(");
-    ctok = tok;
+    bool is_func = consume(TK_IDENT) && consume_id(PU_LPAREN);
+    cc->ctok = tok;
     return is_func;
 }
 
-// top-level = func | gvar
+// top-level = func | gvar | typedef
 void top_level() {
-    if (at_func()) {
+    if (peek_id(KW_TYPEDEF)) {
+        typedef_decl();
+    } else if (at_func()) {
         func();
     } else {
         gvar();
@@ -1049,9 +1092,17 @@ void top_level() {
 
 // program = top-level*
 Prog *parse() {
-    prog = calloc(1, sizeof(Prog));
+    Prog *prog = arena_alloc(&cc->ast_arena, sizeof(Prog), AK_OTHER);
+    cc->prog = prog;
     prog->fns = map_create();
     prog->gvars = vec_create();
+    cc->var_scope = map_create();
+    cc->tag_scope = map_create();
+    cc->var_log = vec_create();
+    cc->tag_log = vec_create();
+    if (cc->pch) {
+        pch_restore();
+    }
     while (!at_eof()) {
         top_level();
     }
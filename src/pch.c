@@ -0,0 +1,477 @@
+#define _XOPEN_SOURCE 700  // realpath
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "10cc.h"
+
+// A precompiled header (PCH) is a snapshot of the declarations of a file after it is parsed: global variables, function
+// prototypes, struct and enum tags, enum constants, typedefs, and macros. A compilation with a PCH starts from the
+// snapshot as if the file had been included before its first line.
+//
+// The file is an image of fixed-size records, which is mapped into memory and read in place. Pointers are written as
+// indices: a type refers to other types by their indices, and a type is written after the types that it refers to, so
+// the types are rebuilt in a single pass. Names are offsets into a string table. Loading a PCH interns the names,
+// rebuilds the types, which must be canonical on the thread, and binds the declarations in the file scope. Macros are
+// kept as the text of #define lines, which are preprocessed ahead of the source.
+//
+// A PCH records the version of 10cc that wrote it and the files that it was built from, and is rejected if any of them
+// has changed.
+
+#ifndef TENCC_BUILD_ID
+#define TENCC_BUILD_ID "unknown"
+#endif
+
+#define PCH_MAGIC "10ccpch"
+
+// Indices of the types that are not written. Types written to a file are numbered from NUM_BUILTIN_TYPES.
+enum { PCH_VOID, PCH_BOOL, PCH_CHAR, PCH_SHORT, PCH_INT, PCH_LONG, PCH_ENUM, NUM_BUILTIN_TYPES };
+
+// Kinds of a binding of a name in the file scope
+enum { PCH_VAR, PCH_TYPEDEF, PCH_ENUM_CONST };
+
+typedef struct {
+    char magic[8];
+    char version[64];  // TENCC_VERSION " " TENCC_BUILD_ID
+    uint64_t hash;     // Hash of the rest of the file
+    uint32_t num_files;
+    uint32_t num_types;
+    uint32_t num_members;
+    uint32_t num_gvars;
+    uint32_t num_funcs;
+    uint32_t num_params;
+    uint32_t num_bindings;
+    uint32_t num_tags;
+    uint32_t macros_size;   // Length of the text of the macros
+    uint32_t strings_size;  // Length of the string table
+} PchHeader;
+
+// A file that the PCH was built from
+typedef struct {
+    uint32_t path;
+    int64_t dev;
+    int64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} PchFile;
+
+typedef struct {
+    int32_t kind;
+    int32_t base;          // Pointer and array
+    int32_t array_size;    // Array
+    int32_t first_member;  // Struct
+    int32_t num_members;   // Struct
+} PchType;
+
+typedef struct {
+    uint32_t name;
+    int32_t type;
+    int32_t offset;
+} PchMember;
+
+// A global variable, a parameter, or a tag
+typedef struct {
+    uint32_t name;
+    int32_t type;
+} PchVar;
+
+typedef struct {
+    uint32_t name;
+    int32_t rtype;
+    int32_t first_param;
+    int32_t num_params;
+} PchFunc;
+
+typedef struct {
+    uint32_t name;
+    int32_t kind;
+    int32_t val;  // Index of the global variable, type of the typedef, or value of the enum constant
+} PchBinding;
+
+// A mapped PCH. The sections follow the header in the order of the fields.
+struct Pch {
+    char *path;
+    char *data;
+    size_t size;
+    PchHeader *header;
+    PchFile *files;
+    PchType *types;
+    PchMember *members;
+    PchVar *gvars;
+    PchFunc *funcs;
+    PchVar *params;
+    PchBinding *bindings;
+    PchVar *tags;
+    char *macros;
+    char *strings;
+    File *macro_file;  // Copy of the macros, which their tokens point into
+};
+
+// A PCH being written. Each section is built in a buffer.
+typedef struct {
+    Buffer *files;
+    Buffer *types;
+    Buffer *members;
+    Buffer *gvars;
+    Buffer *funcs;
+    Buffer *params;
+    Buffer *bindings;
+    Buffer *tags;
+    Buffer *macros;
+    Buffer *strings;
+    Map *type_ids;    // Map<Type *, intptr_t> of the index of each written type plus 1
+    Map *string_ids;  // Map<char *, intptr_t> of the offset of each written string plus 1
+} PchWriter;
+
+// Return the offset of an interned string in the string table, writing it unless it has been.
+uint32_t write_string(PchWriter *w, char *str) {
+    intptr_t id = (intptr_t)map_find(w->string_ids, str);
+    if (!id) {
+        id = w->strings->len + 1;
+        buf_append(w->strings, str, strlen(str) + 1);
+        map_insert(w->string_ids, str, (void *)id);
+    }
+    return id - 1;
+}
+
+// Return the index of a type, writing it and the types that it refers to unless they have been. Map compares keys by
+// address, so types serve as keys as well as interned strings.
+int32_t write_type(PchWriter *w, Type *type) {
+    switch (type->kind) {
+        case TY_VOID:
+            return PCH_VOID;
+        case TY_BOOL:
+            return PCH_BOOL;
+        case TY_CHAR:
+            return PCH_CHAR;
+        case TY_SHORT:
+            return PCH_SHORT;
+        case TY_INT:
+            return PCH_INT;
+        case TY_LONG:
+            return PCH_LONG;
+        case TY_ENUM:
+            return PCH_ENUM;
+        default:
+            break;
+    }
+    intptr_t id = (intptr_t)map_find(w->type_ids, (char *)type);
+    if (id) {
+        return id - 1;
+    }
+
+    PchType rec = {type->kind, -1, type->array_size, 0, 0};
+    if (type->kind == TY_PTR || type->kind == TY_ARY) {
+        rec.base = write_type(w, type->base);
+    } else {
+        // The types of the members are written first, so that the members of a struct are contiguous.
+        int n = type->members->len;
+        PchMember *members = calloc(n ? n : 1, sizeof(PchMember));
+        count_alloc(AK_OTHER, sizeof(PchMember) * (n ? n : 1));
+        for (int i = 0; i < n; i++) {
+            Member *mem = vec_at(type->members->vals, i);
+            members[i] = (PchMember){write_string(w, mem->name), write_type(w, mem->type), mem->offset};
+        }
+        rec.first_member = w->members->len / sizeof(PchMember);
+        rec.num_members = n;
+        buf_append(w->members, (char *)members, n * sizeof(PchMember));
+        free(members);
+    }
+    id = NUM_BUILTIN_TYPES + w->types->len / sizeof(PchType);
+    buf_append(w->types, (char *)&rec, sizeof(rec));
+    map_insert(w->type_ids, (char *)type, (void *)(id + 1));
+    return id;
+}
+
+// Write the stamp of a file that the PCH is built from. The path is made absolute so that the PCH can be used from
+// another directory.
+void write_file_stamp(PchWriter *w, FileStamp *stamp) {
+    char *path = realpath(stamp->path, NULL);
+    if (!path) {
+        error("%s: %s", stamp->path, strerror(errno));
+    }
+    PchFile rec = {write_string(w, intern(path, strlen(path))), stamp->dev, stamp->ino, stamp->size,
+                   stamp->mtime_sec, stamp->mtime_nsec};
+    buf_append(w->files, (char *)&rec, sizeof(rec));
+    free(path);
+}
+
+// Write the declarations of the file scope and the macros to a PCH. The program must have no function definitions.
+void pch_write(char *path) {
+    PchWriter w = {buf_create(), buf_create(), buf_create(), buf_create(), buf_create(),
+                   buf_create(), buf_create(), buf_create(), buf_create(), buf_create(),
+                   map_create(), map_create()};
+
+    // The source file itself is not recorded if it is not a file, e.g. in a compilation of a string.
+    FileStamp stamp;
+    if (stamp_file(cc->file->name, &stamp)) {
+        write_file_stamp(&w, &stamp);
+    }
+    int num_files;
+    FileStamp *stamps = included_files(&num_files);
+    for (int i = 0; i < num_files; i++) {
+        write_file_stamp(&w, &stamps[i]);
+        free(stamps[i].path);
+    }
+    free(stamps);
+
+    Map *gvar_ids = map_create();  // Map<Var *, intptr_t> of the index of each global variable plus 1
+    for (int i = 0; i < cc->prog->gvars->len; i++) {
+        Var *var = vec_at(cc->prog->gvars, i);
+        PchVar rec = {write_string(&w, var->name), write_type(&w, var->type)};
+        buf_append(w.gvars, (char *)&rec, sizeof(rec));
+        map_insert(gvar_ids, (char *)var, (void *)(intptr_t)(i + 1));
+    }
+
+    for (int i = 0; i < cc->prog->fns->len; i++) {
+        Func *fn = vec_at(cc->prog->fns->vals, i);
+        if (fn->body) {
+            error_at(fn->tok->loc, "function definition in a precompiled header");
+        }
+        PchFunc rec = {write_string(&w, fn->name), write_type(&w, fn->rtype), w.params->len / sizeof(PchVar),
+                       fn->params->len};
+        buf_append(w.funcs, (char *)&rec, sizeof(rec));
+        for (int j = 0; j < fn->params->len; j++) {
+            Var *param = vec_at(fn->params, j);
+            PchVar prec = {write_string(&w, param->name), write_type(&w, param->type)};
+            buf_append(w.params, (char *)&prec, sizeof(prec));
+        }
+    }
+
+    // Only the innermost binding of a name is visible, and the file scope is never left.
+    for (int i = 0; i < cc->var_scope->len; i++) {
+        VarScope *sc = vec_at(cc->var_scope->vals, i);
+        if (!sc) {
+            continue;
+        }
+        PchBinding rec = {write_string(&w, sc->name)};
+        if (sc->var) {
+            rec.kind = PCH_VAR;
+            rec.val = (intptr_t)map_find(gvar_ids, (char *)sc->var) - 1;
+        } else if (sc->type_def) {
+            rec.kind = PCH_TYPEDEF;
+            rec.val = write_type(&w, sc->type_def);
+        } else {
+            rec.kind = PCH_ENUM_CONST;
+            rec.val = sc->enum_val;
+        }
+        buf_append(w.bindings, (char *)&rec, sizeof(rec));
+    }
+    for (int i = 0; i < cc->tag_scope->len; i++) {
+        TagScope *sc = vec_at(cc->tag_scope->vals, i);
+        if (sc) {
+            PchVar rec = {write_string(&w, sc->name), write_type(&w, sc->type)};
+            buf_append(w.tags, (char *)&rec, sizeof(rec));
+        }
+    }
+
+    dump_macros(w.macros);
+
+    Buffer *sections[] = {w.files, w.types, w.members, w.gvars,  w.funcs,
+                          w.params, w.bindings, w.tags, w.macros, w.strings};
+    PchHeader header = {PCH_MAGIC, TENCC_VERSION " " TENCC_BUILD_ID, HASH64_INIT};
+    header.num_files = w.files->len / sizeof(PchFile);
+    header.num_types = w.types->len / sizeof(PchType);
+    header.num_members = w.members->len / sizeof(PchMember);
+    header.num_gvars = w.gvars->len / sizeof(PchVar);
+    header.num_funcs = w.funcs->len / sizeof(PchFunc);
+    header.num_params = w.params->len / sizeof(PchVar);
+    header.num_bindings = w.bindings->len / sizeof(PchBinding);
+    header.num_tags = w.tags->len / sizeof(PchVar);
+    header.macros_size = w.macros->len;
+    header.strings_size = w.strings->len;
+    Buffer *buf = buf_create();
+    buf_append(buf, (char *)&header, sizeof(header));
+    for (int i = 0; i < sizeof(sections) / sizeof(*sections); i++) {
+        header.hash = hash64(header.hash, sections[i]->data, sections[i]->len);
+        buf_append(buf, sections[i]->data, sections[i]->len);
+        buf_free(sections[i]);
+    }
+    memcpy(buf->data, &header, sizeof(header));
+    write_output(path, buf->data, buf->len);
+    buf_free(buf);
+}
+
+// Map a PCH, and check that it can be used. Return the tokens of its macros followed by tok, the tokens of the source.
+Token *pch_load(char *path, Token *tok) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        error("%s: cannot read precompiled header: %s", path, strerror(errno));
+    }
+    char *data = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        error("%s: malformed precompiled header", path);
+    }
+    Pch *pch = calloc(1, sizeof(Pch));
+    count_alloc(AK_OTHER, sizeof(Pch));
+    pch->path = path;
+    pch->data = data;
+    pch->size = st.st_size;
+    cc->pch = pch;
+
+    PchHeader *h = pch->header = (PchHeader *)data;
+    if (pch->size < sizeof(PchHeader) || memcmp(h->magic, PCH_MAGIC, sizeof(PCH_MAGIC))) {
+        error("%s: malformed precompiled header", path);
+    }
+    if (strncmp(h->version, TENCC_VERSION " " TENCC_BUILD_ID, sizeof(h->version))) {
+        error("%s: precompiled header was built by another version of 10cc", path);
+    }
+    size_t size = sizeof(PchHeader) + h->num_files * sizeof(PchFile) + h->num_types * sizeof(PchType) +
+                  h->num_members * sizeof(PchMember) + h->num_gvars * sizeof(PchVar) +
+                  h->num_funcs * sizeof(PchFunc) + h->num_params * sizeof(PchVar) +
+                  h->num_bindings * sizeof(PchBinding) + h->num_tags * sizeof(PchVar) + h->macros_size +
+                  h->strings_size;
+    if (size != pch->size || hash64(HASH64_INIT, data + sizeof(PchHeader), size - sizeof(PchHeader)) != h->hash) {
+        error("%s: malformed precompiled header", path);
+    }
+    char *p = data + sizeof(PchHeader);
+    pch->files = (PchFile *)p;
+    p += h->num_files * sizeof(PchFile);
+    pch->types = (PchType *)p;
+    p += h->num_types * sizeof(PchType);
+    pch->members = (PchMember *)p;
+    p += h->num_members * sizeof(PchMember);
+    pch->gvars = (PchVar *)p;
+    p += h->num_gvars * sizeof(PchVar);
+    pch->funcs = (PchFunc *)p;
+    p += h->num_funcs * sizeof(PchFunc);
+    pch->params = (PchVar *)p;
+    p += h->num_params * sizeof(PchVar);
+    pch->bindings = (PchBinding *)p;
+    p += h->num_bindings * sizeof(PchBinding);
+    pch->tags = (PchVar *)p;
+    p += h->num_tags * sizeof(PchVar);
+    pch->macros = p;
+    pch->strings = p + h->macros_size;
+
+    for (int i = 0; i < h->num_files; i++) {
+        PchFile *f = &pch->files[i];
+        FileStamp stamp = {pch->strings + f->path, f->dev, f->ino, f->size, f->mtime_sec, f->mtime_nsec};
+        if (is_file_changed(&stamp)) {
+            error("%s: %s has changed since the precompiled header was built", path, stamp.path);
+        }
+    }
+
+    pch->macro_file = new_file(path, pch->macros, h->macros_size);
+    vec_push(cc->files, pch->macro_file);
+    Token *macros = tokenize(pch->macro_file, &cc->token_arena);
+    if (macros->kind == TK_EOF) {
+        return tok;
+    }
+    Token *last = macros;
+    while (last->next->kind != TK_EOF) {
+        last = last->next;
+    }
+    last->next = tok;
+    return macros;
+}
+
+// Return true if a PCH was built from a file.
+bool pch_contains(Pch *pch, FileStamp *stamp) {
+    for (uint32_t i = 0; i < pch->header->num_files; i++) {
+        if (pch->files[i].dev == stamp->dev && pch->files[i].ino == stamp->ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return an interned name in the string table of a PCH.
+char *pch_name(Pch *pch, uint32_t offset) { return intern(pch->strings + offset, strlen(pch->strings + offset)); }
+
+// Declare the globals, functions, tags, enum constants, and typedefs of the PCH of the compilation in the file scope.
+void pch_restore() {
+    Pch *pch = cc->pch;
+    PchHeader *h = pch->header;
+
+    Type **types = arena_alloc(&cc->ast_arena, sizeof(Type *) * (NUM_BUILTIN_TYPES + h->num_types), AK_OTHER);
+    types[PCH_VOID] = void_type();
+    types[PCH_BOOL] = bool_type();
+    types[PCH_CHAR] = char_type();
+    types[PCH_SHORT] = short_type();
+    types[PCH_INT] = int_type();
+    types[PCH_LONG] = long_type();
+    types[PCH_ENUM] = enum_type();
+    for (int i = 0; i < h->num_types; i++) {
+        PchType *t = &pch->types[i];
+        Type **type = &types[NUM_BUILTIN_TYPES + i];
+        if (t->kind == TY_PTR) {
+            *type = ptr_to(types[t->base]);
+        } else if (t->kind == TY_ARY) {
+            *type = ary_of(types[t->base], t->array_size);
+        } else {
+            Map *members = map_create();
+            for (int j = 0; j < t->num_members; j++) {
+                PchMember *m = &pch->members[t->first_member + j];
+                Member *mem = arena_alloc(&cc->ast_arena, sizeof(Member), AK_MEMBER);
+                mem->name = pch_name(pch, m->name);
+                mem->type = types[m->type];
+                mem->offset = m->offset;
+                map_insert(members, mem->name, mem);
+            }
+            *type = struct_type(members);
+        }
+    }
+
+    Var **gvars = arena_alloc(&cc->ast_arena, sizeof(Var *) * (h->num_gvars ? h->num_gvars : 1), AK_OTHER);
+    for (int i = 0; i < h->num_gvars; i++) {
+        Var *var = gvars[i] = arena_alloc(&cc->ast_arena, sizeof(Var), AK_VAR);
+        var->name = pch_name(pch, pch->gvars[i].name);
+        var->type = types[pch->gvars[i].type];
+        vec_push(cc->prog->gvars, var);
+    }
+
+    for (int i = 0; i < h->num_funcs; i++) {
+        PchFunc *f = &pch->funcs[i];
+        Func *fn = arena_alloc(&cc->ast_arena, sizeof(Func), AK_FUNC);
+        fn->name = pch_name(pch, f->name);
+        fn->rtype = types[f->rtype];
+        fn->lvars = vec_create();
+        fn->strs = vec_create();
+        fn->params = vec_create();
+        for (int j = 0; j < f->num_params; j++) {
+            PchVar *p = &pch->params[f->first_param + j];
+            Var *param = arena_alloc(&cc->ast_arena, sizeof(Var), AK_VAR);
+            param->name = pch_name(pch, p->name);
+            param->type = types[p->type];
+            param->is_local = true;
+            vec_push(fn->params, param);
+        }
+        map_insert(cc->prog->fns, fn->name, fn);
+    }
+
+    for (int i = 0; i < h->num_bindings; i++) {
+        PchBinding *b = &pch->bindings[i];
+        VarScope *sc = push_var_scope(pch_name(pch, b->name));
+        if (b->kind == PCH_VAR) {
+            sc->var = gvars[b->val];
+        } else if (b->kind == PCH_TYPEDEF) {
+            sc->type_def = types[b->val];
+        } else {
+            sc->enum_type = enum_type();
+            sc->enum_val = b->val;
+        }
+    }
+    for (int i = 0; i < h->num_tags; i++) {
+        push_tag_scope(pch_name(pch, pch->tags[i].name))->type = types[pch->tags[i].type];
+    }
+}
+
+// Return the hash of a PCH, which changes whenever its contents do.
+uint64_t pch_hash(Pch *pch) { return pch->header->hash; }
+
+// Unmap a PCH.
+void pch_close(Pch *pch) {
+    munmap(pch->data, pch->size);
+    if (pch->macro_file) {
+        free(pch->macro_file->contents);
+        free(pch->macro_file->lines);
+        free(pch->macro_file);
+    }
+    free(pch);
+}
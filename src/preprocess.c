@@ -1,27 +1,1138 @@
+#define _POSIX_C_SOURCE 200809L  // struct stat.st_mtim
+
+#include <sys/stat.h>
+
 #include "10cc.h"
 
-bool is_hash(Token *tok) { return tok->is_bol && !strcmp(tok->str, "#"); }
+// Files included by #include are read and tokenized once per thread, and their tokens are kept in a cache for later
+// includes and compilations on the thread. A cached file is checked for modification once per compilation, and read
+// again if it has changed. Including a file copies its tokens, as preprocessing links tokens into a single list.
+//
+// A file of the form "#ifndef X / #define X / ... / #endif" or with "#pragma once" is recognized when it is tokenized,
+// and including it again is skipped without looking at its tokens.
+//
+// Macros are expanded with hide sets (Prosser's algorithm): each token carries the set of macros whose expansion
+// produced it, and a macro is not expanded at a token whose hide set contains it. The body of a macro is kept as an
+// array of tokens with its parameters resolved, so an expansion copies the tokens of the body and the arguments, and
+// leaves the rest of the token list as is. A macro defined in a header is parsed once per thread.
+//
+// The tokenizer leaves the lines after #if, #ifdef, #ifndef, #elif, and #else to the next directive of the conditional
+// as a Group, which is found by looking only at "#" at the beginning of each line. A group is tokenized when its
+// condition holds, so the lines of a false condition cost no more than a scan for new lines. The tokens of a group in a
+// header are cached along with the header.
 
-Token *preprocess(Token *tok) {
+struct Header {
+    Header *next;     // Next header in the same slot of the cache
+    FileStamp stamp;  // The file when it was read; path is the interned resolved path
+    File *file;
+    Token *tokens;  // Tokens of the file, or NULL if it failed to tokenize
+    Token *body;    // First token to include
+    Token *end;     // Token after the last one to include
+    char *guard;    // Macro of the include guard, or NULL
+    bool once;      // true if the file has #pragma once
+    bool in_pch;    // true if the PCH was built from the file, which is never included again
+};
+
+struct Macro {
+    char *name;     // NULL until the macro is parsed
+    bool is_func;   // true if the macro is function-like
+    int num_params;
+    Token *body;    // Tokens of the replacement list
+    int *param_of;  // Index of the parameter that each token of body is, or -1
+    int body_len;
+};
+
+struct HideSet {
+    HideSet *next;
+    char *name;
+};
+
+// An argument of a function-like macro
+typedef struct {
+    Token *start;         // First token
+    Token *end;           // Token after the last one
+    Token *expanded;      // First token of the argument with macros expanded, or NULL if not computed yet
+    Token *expanded_end;  // Token after the last one of the expanded argument
+} MacroArg;
+
+#define HEADER_SLOTS 1024
+#define MAX_INCLUDE_DEPTH 200
+
+_Thread_local Header *headers[HEADER_SLOTS];  // Cache of the files included on this thread
+_Thread_local Arena header_arena;             // Tokens of the files in the cache, which are never released
+
+bool is_hash(Token *tok) { return tok->is_bol && tok->kind == TK_RESERVED && tok->id == PU_HASH; }
+
+// Return true if a token is "#" of a given directive.
+bool is_directive(Token *tok, char *name) {
+    return is_hash(tok) && !tok->next->is_bol && !strcmp(tok->next->str, name);
+}
+
+// Skip the rest of a line.
+Token *skip_line(Token *tok) {
+    while (!tok->is_bol) {
+        tok = tok->next;
+    }
+    return tok;
+}
+
+// Record the identity of a file. Return false if it is not a regular file.
+bool stamp_file(char *path, FileStamp *stamp) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    stamp->path = path;
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime_sec = st.st_mtim.tv_sec;
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+    stamp->missing = false;
+    return true;
+}
+
+// Return true if a file has changed since it was stamped. A missing file has changed once it exists.
+bool is_file_changed(FileStamp *stamp) {
+    FileStamp now;
+    if (stamp->missing) {
+        return stamp_file(stamp->path, &now);
+    }
+    return !stamp_file(stamp->path, &now) || now.dev != stamp->dev || now.ino != stamp->ino ||
+           now.size != stamp->size || now.mtime_sec != stamp->mtime_sec || now.mtime_nsec != stamp->mtime_nsec;
+}
+
+// Return the stamps of the files included by the compilation, which the caller frees along with their paths.
+FileStamp *included_files(int *num_files) {
+    *num_files = cc->includes ? cc->includes->len : 0;
+    FileStamp *stamps = malloc(sizeof(FileStamp) * (*num_files ? *num_files : 1));
+    count_alloc(AK_OTHER, sizeof(FileStamp) * (*num_files ? *num_files : 1));
+    for (int i = 0; i < *num_files; i++) {
+        Header *h = vec_at(cc->includes->vals, i);
+        stamps[i] = h->stamp;
+        stamps[i].path = format("%s", h->stamp.path);
+    }
+    return stamps;
+}
+
+// Return the stamps of the files that the result of the compilation depends on, which the caller frees along with their
+// paths. Besides the included files, these are the paths that #include looked for and did not find, since a file
+// created at one of them may take the place of the file that was included.
+FileStamp *dependencies(int *num_deps) {
+    int num_files;
+    FileStamp *stamps = included_files(&num_files);
+    int num_missing = cc->missing ? cc->missing->len : 0;
+    *num_deps = num_files + num_missing;
+    stamps = realloc(stamps, sizeof(FileStamp) * (*num_deps ? *num_deps : 1));
+    count_alloc(AK_OTHER, sizeof(FileStamp) * (*num_deps ? *num_deps : 1));
+    for (int i = 0; i < num_missing; i++) {
+        stamps[num_files + i] = (FileStamp){.path = format("%s", vec_at(cc->missing->keys, i)), .missing = true};
+    }
+    return stamps;
+}
+
+// Return the bytes that the header cache of this thread holds.
+size_t header_cache_size() {
+    size_t size = header_arena.reserved;
+    for (int i = 0; i < HEADER_SLOTS; i++) {
+        for (Header *h = headers[i]; h; h = h->next) {
+            size += sizeof(Header) + (h->file ? h->file->size + sizeof(int) * h->file->num_lines : 0);
+        }
+    }
+    return size;
+}
+
+// Free the header cache of this thread. No header of the thread may be in use.
+void release_headers() {
+    for (int i = 0; i < HEADER_SLOTS; i++) {
+        while (headers[i]) {
+            Header *h = headers[i];
+            headers[i] = h->next;
+            if (h->file) {
+                free(h->file->name);
+                free(h->file->contents);
+                free(h->file->lines);
+                free(h->file);
+            }
+            free(h);
+        }
+    }
+    arena_release(&header_arena);
+}
+
+// Return true if tokens have #pragma once.
+bool has_pragma_once(Token *tok) {
+    for (; tok->kind != TK_EOF; tok = tok->next) {
+        if (is_directive(tok, "pragma") && !strcmp(tok->next->next->str, "once") && !tok->next->next->is_bol) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Allocate the memo of the macro of each #define in the tokens of a header.
+void add_macro_memos(Token *tok) {
+    for (; tok->kind != TK_EOF; tok = tok->next) {
+        if (is_directive(tok, "define")) {
+            tok->macro = arena_alloc(&header_arena, sizeof(Macro), AK_MACRO);
+        }
+    }
+}
+
+// Tokenize a group unless it has been, and return its tokens.
+Token *tokenize_group(Group *group) {
+    if (!group->tokens) {
+        group->tokens = tokenize_range(group->file, group->start, group->end, group->arena);
+        if (group->arena == &header_arena) {
+            add_macro_memos(group->tokens);
+        }
+    }
+    return group->tokens;
+}
+
+// Find the include guard and #pragma once of a header.
+void scan_header(Header *h) {
+    h->body = h->tokens;
+    h->end = NULL;
+    h->once = has_pragma_once(h->tokens);
+    add_macro_memos(h->tokens);
+
+    // #ifndef X
+    // #define X
+    // ...
+    // #endif
+    Token *tok = h->tokens;
+    if (!is_directive(tok, "ifndef") || !tok->group) {
+        return;
+    }
+    Token *name = tok->next->next;
+    Token *endif = skip_line(tok->next);
+    if (name->kind != TK_IDENT || name->is_bol || !is_directive(endif, "endif") ||
+        skip_line(endif->next)->kind != TK_EOF) {
+        return;
+    }
+    Token *body = tokenize_group(tok->group);
+    Token *def_name = body->next->next;
+    if (!is_directive(body, "define") || def_name->str != name->str || def_name->is_bol || !def_name->next->is_bol) {
+        return;
+    }
+    h->once |= has_pragma_once(body);
+    h->guard = name->str;
+    h->body = body;
+}
+
+// Resolve a relative path against the working directory of the compilation, and return it interned.
+char *resolve_path(char *name) {
+    char *resolved = cc->working_dir && name[0] != '/' ? format("%s/%s", cc->working_dir, name) : format("%s", name);
+    char *path = intern(resolved, strlen(resolved));
+    free(resolved);
+    return path;
+}
+
+// Return a header, reading it unless it is in the cache and has not changed. *seen is set to true if the compilation
+// has included it already. NULL is returned if the header does not exist.
+Header *load_header(char *name, bool *seen) {
+    char *path = resolve_path(name);
+
+    Header *h = map_find(cc->includes, path);
+    *seen = h;
+    if (h) {
+        return h;
+    }
+    FileStamp stamp;
+    if (!stamp_file(path, &stamp)) {
+        map_insert(cc->missing, path, path);
+        return NULL;
+    }
+
+    // A file that the PCH was built from has already been included, and is not read again.
+    if (cc->pch && pch_contains(cc->pch, &stamp)) {
+        h = arena_alloc(&cc->token_arena, sizeof(Header), AK_OTHER);
+        h->stamp = stamp;
+        h->in_pch = true;
+        map_insert(cc->includes, path, h);
+        return h;
+    }
+
+    Header **slot = &headers[hash64(HASH64_INIT, path, strlen(path)) % HEADER_SLOTS];
+    for (h = *slot; h && h->stamp.path != path; h = h->next) {
+    }
+    if (!h) {
+        h = calloc(1, sizeof(Header));
+        count_alloc(AK_SOURCE, sizeof(Header));
+        h->next = *slot;
+        *slot = h;
+    }
+    map_insert(cc->includes, path, h);
+
+    if (h->tokens && h->stamp.dev == stamp.dev && h->stamp.ino == stamp.ino && h->stamp.size == stamp.size &&
+        h->stamp.mtime_sec == stamp.mtime_sec && h->stamp.mtime_nsec == stamp.mtime_nsec) {
+        vec_push(cc->files, h->file);
+        return h;
+    }
+
+    // Read the file. The tokens of the previous contents stay in header_arena, but nothing refers to them.
+    if (h->file) {
+        free(h->file->name);
+        free(h->file->contents);
+        free(h->file->lines);
+        free(h->file);
+    }
+    h->stamp = stamp;
+    h->tokens = NULL;
+    h->guard = NULL;
+    h->once = false;
+    size_t size;
+    char *src = read_source(path, &size);
+    h->file = new_file(format("%s", name), src, size);
+    free(src);
+    vec_push(cc->files, h->file);
+    h->tokens = tokenize(h->file, &header_arena);
+    scan_header(h);
+    return h;
+}
+
+// Find a header. A quoted name is searched in the directory of the including file first, and then in the include
+// paths.
+Header *find_header(char *name, bool quoted, File *from, bool *seen) {
+    if (name[0] == '/') {
+        return load_header(name, seen);
+    }
+    if (quoted) {
+        char *slash = strrchr(from->name, '/');
+        char *path = format("%.*s%s", slash ? (int)(slash - from->name + 1) : 0, from->name, name);
+        Header *h = load_header(path, seen);
+        free(path);
+        if (h) {
+            return h;
+        }
+    }
+    for (int i = 0; i < cc->num_include_paths; i++) {
+        char *path = format("%s/%s", cc->include_paths[i], name);
+        Header *h = load_header(path, seen);
+        free(path);
+        if (h) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+// Copy the tokens from tok to end (exclusive) or EOF, and terminate them with EOF.
+Token *copy_tokens(Token *tok, Token *end) {
+    Token head = {};
+    Token *cur = &head;
+    for (; tok != end && tok->kind != TK_EOF; tok = tok->next) {
+        cur = cur->next = arena_alloc(&cc->token_arena, sizeof(Token), AK_TOKEN);
+        *cur = *tok;
+    }
+    cur = cur->next = arena_alloc(&cc->token_arena, sizeof(Token), AK_TOKEN);
+    *cur = *tok;
+    cur->kind = TK_EOF;
+    cur->next = NULL;
+    return head.next;
+}
+
+// Return the tokens of a group to preprocess. The tokens of a group in a header are copied, as the header cache keeps
+// them.
+Token *group_tokens(Group *group) {
+    Token *tok = tokenize_group(group);
+    return group->arena == &header_arena ? copy_tokens(tok, NULL) : tok;
+}
+
+// Return true if a token is a given punctuator.
+bool is_punct(Token *tok, ReservedId id) { return tok->kind == TK_RESERVED && tok->id == id; }
+
+// Return true if a hide set contains a macro.
+bool hideset_contains(HideSet *hs, char *name) {
+    for (; hs; hs = hs->next) {
+        if (hs->name == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the union of two hide sets. b is shared with the result.
+HideSet *hideset_union(HideSet *a, HideSet *b) {
+    // Hide sets along an expansion usually nest, so a is often a subset of b.
+    HideSet *x = a;
+    while (x && hideset_contains(b, x->name)) {
+        x = x->next;
+    }
+    if (!x) {
+        return b;
+    }
+    HideSet head = {};
+    HideSet *cur = &head;
+    for (; a; a = a->next) {
+        if (!hideset_contains(b, a->name)) {
+            cur = cur->next = arena_alloc(&cc->token_arena, sizeof(HideSet), AK_HIDESET);
+            cur->name = a->name;
+        }
+    }
+    cur->next = b;
+    return head.next;
+}
+
+// Return the intersection of two hide sets.
+HideSet *hideset_intersection(HideSet *a, HideSet *b) {
+    HideSet head = {};
+    HideSet *cur = &head;
+    for (; a; a = a->next) {
+        if (hideset_contains(b, a->name)) {
+            cur = cur->next = arena_alloc(&cc->token_arena, sizeof(HideSet), AK_HIDESET);
+            cur->name = a->name;
+        }
+    }
+    return head.next;
+}
+
+// Return a hide set with a macro added.
+HideSet *hideset_add(HideSet *hs, char *name) {
+    HideSet *added = arena_alloc(&cc->token_arena, sizeof(HideSet), AK_HIDESET);
+    added->name = name;
+    added->next = hs;
+    return added;
+}
+
+// Append a copy of a token to *cur with a hide set added. Tokens from expansions are never at the beginning of a line,
+// so that they are not taken as directives.
+void append_token(Token **cur, Token *tok, HideSet *hs) {
+    Token *copy = arena_alloc(&cc->token_arena, sizeof(Token), AK_TOKEN);
+    *copy = *tok;
+    copy->next = NULL;
+    copy->is_bol = false;
+    copy->hideset = hideset_union(tok->hideset, hs);
+    *cur = (*cur)->next = copy;
+}
+
+// Tokenize text made by # or ##. NULL is returned unless it is a single token.
+Token *tokenize_scratch(char *text) {
+    File *file = new_file("<scratch space>", text, strlen(text));
+    vec_push(cc->scratch, file);
+    vec_push(cc->files, file);
+    Token *tok = tokenize(file, &cc->token_arena);
+    return tok->kind != TK_EOF && tok->next->kind == TK_EOF ? tok : NULL;
+}
+
+// Make a string literal from the spelling of the tokens from tok to end (exclusive). Tokens are separated by a space
+// if they are in the source, and '"' and '\' in string and character literals are escaped.
+Token *stringize(Token *tok, Token *end) {
+    Buffer *buf = buf_create_cap(64);
+    buf_append(buf, "\"", 1);
+    for (Token *t = tok; t != end; t = t->next) {
+        if (t != tok && t->has_space) {
+            buf_append(buf, " ", 1);
+        }
+        bool quoted = t->kind == TK_STR || (t->kind == TK_NUM && t->loc[0] == '\'');
+        for (int i = 0; i < t->len; i++) {
+            if (quoted && (t->loc[i] == '"' || t->loc[i] == '\\')) {
+                buf_append(buf, "\\", 1);
+            }
+            buf_append(buf, t->loc + i, 1);
+        }
+    }
+    buf_append(buf, "\"", 2);
+    Token *str = tokenize_scratch(buf->data);
+    buf_free(buf);
+    return str;
+}
+
+// Paste two tokens into one.
+Token *paste(Token *lhs, Token *rhs, Token *op) {
+    char *text = format("%.*s%.*s", lhs->len, lhs->loc, rhs->len, rhs->loc);
+    Token *tok = tokenize_scratch(text);
+    if (!tok) {
+        error_at(op->loc, "pasting \"%.*s\" and \"%.*s\" does not give a valid preprocessing token", lhs->len,
+                 lhs->loc, rhs->len, rhs->loc);
+    }
+    free(text);
+    return tok;
+}
+
+// Parse #define, where tok is the name of the macro. The macro is stored into m, which is allocated from arena if m is
+// NULL. m->name is set last, so that m stays unparsed if the directive has an error.
+Macro *read_macro(Token *tok, Macro *m, Arena *arena) {
+    if (tok->is_bol || tok->kind != TK_IDENT) {
+        error_at(tok->loc, "macro names must be identifiers");
+    }
+    if (!m) {
+        m = arena_alloc(arena, sizeof(Macro), AK_MACRO);
+    }
+    Token *name = tok;
+    tok = tok->next;
+
+    // Parameters. "(" must follow the name immediately.
+    Vector *params = vec_create();
+    m->is_func = !tok->is_bol && !tok->has_space && is_punct(tok, PU_LPAREN);
+    if (m->is_func) {
+        tok = tok->next;
+        while (!is_punct(tok, PU_RPAREN)) {
+            if (params->len) {
+                if (tok->is_bol || !is_punct(tok, PU_COMMA)) {
+                    error_at(tok->loc, "expected ',' or ')' in macro parameter list");
+                }
+                tok = tok->next;
+            }
+            if (tok->is_bol || tok->kind != TK_IDENT) {
+                error_at(tok->loc, "expected parameter name");
+            }
+            for (int i = 0; i < params->len; i++) {
+                if (vec_at(params, i) == tok->str) {
+                    error_at(tok->loc, "duplicate macro parameter \"%s\"", tok->str);
+                }
+            }
+            vec_push(params, tok->str);
+            tok = tok->next;
+        }
+        tok = tok->next;
+    }
+    m->num_params = params->len;
+
+    // Replacement list
+    int len = 0;
+    for (Token *t = tok; !t->is_bol; t = t->next) {
+        len++;
+    }
+    m->body = arena_alloc(arena, sizeof(Token) * (len ? len : 1), AK_MACRO);
+    m->param_of = arena_alloc(arena, sizeof(int) * (len ? len : 1), AK_MACRO);
+    m->body_len = len;
+    for (int i = 0; i < len; i++, tok = tok->next) {
+        m->body[i] = *tok;
+        m->body[i].next = NULL;
+        m->param_of[i] = -1;
+        for (int j = 0; tok->kind == TK_IDENT && j < params->len; j++) {
+            if (vec_at(params, j) == tok->str) {
+                m->param_of[i] = j;
+            }
+        }
+    }
+
+    // Check the operands of # and ##.
+    for (int i = 0; i < len; i++) {
+        if (m->is_func && is_punct(&m->body[i], PU_HASH) && (i + 1 == len || m->param_of[i + 1] == -1)) {
+            error_at(m->body[i].loc, "'#' is not followed by a macro parameter");
+        }
+        if (is_punct(&m->body[i], PU_HASHHASH) && (i == 0 || i + 1 == len)) {
+            error_at(m->body[i].loc, "'##' cannot appear at either end of a macro expansion");
+        }
+    }
+    m->name = name->str;
+    return m;
+}
+
+// Process #define, where hash is its "#". Return the token after the directive.
+Token *define_macro(Token *hash) {
+    Macro *m = hash->macro;
+    if (!m || !m->name) {
+        m = read_macro(hash->next->next, m, m ? &header_arena : &cc->token_arena);
+    }
+    map_insert(cc->macros, m->name, m);
+    return skip_line(hash->next);
+}
+
+// Process #undef, where tok is "undef". Return the token after the directive.
+Token *undef_macro(Token *tok) {
+    tok = tok->next;
+    if (tok->is_bol || tok->kind != TK_IDENT) {
+        error_at(tok->loc, "macro names must be identifiers");
+    }
+    map_insert(cc->macros, tok->str, NULL);
+    return skip_line(tok);
+}
+
+// Append the macros defined so far to buf as #define lines. A macro keeps only the positions of its parameters, so
+// they are renamed.
+void dump_macros(Buffer *buf) {
+    for (int i = 0; i < cc->macros->len; i++) {
+        Macro *m = vec_at(cc->macros->vals, i);
+        if (!m) {
+            continue;
+        }
+        char *s = format("#define %s", m->name);
+        buf_append(buf, s, strlen(s));
+        free(s);
+        if (m->is_func) {
+            buf_append(buf, "(", 1);
+            for (int j = 0; j < m->num_params; j++) {
+                s = format("%s__p%d", j ? ", " : "", j);
+                buf_append(buf, s, strlen(s));
+                free(s);
+            }
+            buf_append(buf, ")", 1);
+        }
+        for (int j = 0; j < m->body_len; j++) {
+            Token *tok = &m->body[j];
+            s = m->param_of[j] == -1 ? format("%s%.*s", j == 0 || tok->has_space ? " " : "", tok->len, tok->loc)
+                                     : format("%s__p%d", j == 0 || tok->has_space ? " " : "", m->param_of[j]);
+            buf_append(buf, s, strlen(s));
+            free(s);
+        }
+        buf_append(buf, "\n", 1);
+    }
+}
+
+// Read the arguments of a function-like macro, where tok is "(". *rparen is set to the closing ")".
+MacroArg *read_macro_args(Macro *m, Token *name, Token *tok, Token **rparen) {
+    MacroArg *args = arena_alloc(&cc->token_arena, sizeof(MacroArg) * (m->num_params ? m->num_params : 1), AK_MACRO);
+    int num_args = 0;
+    int depth = 0;
+    Token *lparen = tok;
+    Token *start = tok->next;
+    for (tok = tok->next;; tok = tok->next) {
+        if (tok->kind == TK_EOF) {
+            error_at(name->loc, "unterminated argument list invoking macro \"%s\"", m->name);
+        }
+        if (depth == 0 && (is_punct(tok, PU_COMMA) || is_punct(tok, PU_RPAREN))) {
+            if (num_args < m->num_params) {
+                args[num_args].start = start;
+                args[num_args].end = tok;
+            }
+            num_args++;
+            start = tok->next;
+            if (is_punct(tok, PU_RPAREN)) {
+                break;
+            }
+            continue;
+        }
+        depth += is_punct(tok, PU_LPAREN);
+        depth -= is_punct(tok, PU_RPAREN);
+    }
+
+    // f() passes no arguments to a macro without parameters.
+    if (m->num_params == 0 && num_args == 1 && lparen->next == tok) {
+        num_args = 0;
+    }
+    if (num_args < m->num_params) {
+        error_at(tok->loc, "macro \"%s\" requires %d arguments, but only %d given", m->name, m->num_params, num_args);
+    }
+    if (num_args > m->num_params) {
+        error_at(name->loc, "macro \"%s\" passed %d arguments, but takes just %d", m->name, num_args, m->num_params);
+    }
+    *rparen = tok;
+    return args;
+}
+
+Token *expand_macro(Token *tok);
+
+// Return an EOF token at the location of a given token.
+Token *new_eof(Token *tok) {
+    Token *eof = arena_alloc(&cc->token_arena, sizeof(Token), AK_TOKEN);
+    *eof = *tok;
+    eof->kind = TK_EOF;
+    eof->next = NULL;
+    return eof;
+}
+
+// Expand the macros in tokens terminated by EOF. Return the first token of the result, which ends with the same EOF.
+Token *expand_tokens(Token *tok) {
+    Token head = {};
+    Token *cur = &head;
+    while (tok->kind != TK_EOF) {
+        Token *expanded = expand_macro(tok);
+        if (expanded) {
+            tok = expanded;
+            continue;
+        }
+        cur = cur->next = tok;
+        tok = tok->next;
+    }
+    cur->next = tok;
+    return head.next;
+}
+
+// Expand macros in an argument, and set arg->expanded and arg->expanded_end. An argument without macros is used as is.
+void expand_arg(MacroArg *arg) {
+    if (arg->expanded) {
+        return;
+    }
+    bool has_macro = false;
+    for (Token *t = arg->start; t != arg->end && !has_macro; t = t->next) {
+        has_macro = t->kind == TK_IDENT && map_find(cc->macros, t->str);
+    }
+    if (!has_macro) {
+        arg->expanded = arg->start;
+        arg->expanded_end = arg->end;
+        return;
+    }
+
+    // Expand macros in a copy of the argument terminated by EOF, so that an invocation cannot extend beyond it.
+    Token head = {};
+    Token *cur = &head;
+    for (Token *t = arg->start; t != arg->end; t = t->next) {
+        append_token(&cur, t, NULL);
+    }
+    Token *eof = new_eof(arg->end);
+    cur->next = eof;
+    arg->expanded = expand_tokens(head.next);
+    arg->expanded_end = eof;
+}
+
+// Append the replacement list of a macro to *cur, with its parameters replaced by args, and with hs added to the hide
+// set of every token.
+void substitute(Macro *m, MacroArg *args, HideSet *hs, Token **cur) {
+    bool placemarker = false;  // true if the left operand of the next ## is an empty argument
+    for (int i = 0; i < m->body_len; i++) {
+        Token *tok = &m->body[i];
+        int param = m->param_of[i];
+
+        // # param
+        if (m->is_func && is_punct(tok, PU_HASH)) {
+            MacroArg *arg = &args[m->param_of[++i]];
+            append_token(cur, stringize(arg->start, arg->end), hs);
+            continue;
+        }
+
+        // lhs ## rhs, where lhs has been appended
+        if (is_punct(tok, PU_HASHHASH)) {
+            Token *op = tok;
+            tok = &m->body[++i];
+            param = m->param_of[i];
+            Token *rhs = param == -1 ? tok : args[param].start;
+            if (param != -1 && rhs == args[param].end) {
+                continue;  // An empty argument leaves lhs as is.
+            }
+            if (placemarker) {
+                append_token(cur, rhs, hs);
+            } else {
+                Token *pasted = paste(*cur, rhs, op);
+                pasted->has_space = (*cur)->has_space;
+                pasted->is_bol = false;
+                pasted->hideset = hs;
+                **cur = *pasted;
+            }
+            placemarker = false;
+            for (Token *t = rhs->next; param != -1 && t != args[param].end; t = t->next) {
+                append_token(cur, t, hs);
+            }
+            continue;
+        }
+
+        if (param != -1) {
+            MacroArg *arg = &args[param];
+
+            // The left operand of ## is not expanded.
+            if (i + 1 < m->body_len && is_punct(&m->body[i + 1], PU_HASHHASH)) {
+                placemarker = arg->start == arg->end;
+                for (Token *t = arg->start; t != arg->end; t = t->next) {
+                    append_token(cur, t, hs);
+                }
+                continue;
+            }
+            expand_arg(arg);
+            for (Token *t = arg->expanded; t != arg->expanded_end; t = t->next) {
+                append_token(cur, t, hs);
+            }
+            continue;
+        }
+        append_token(cur, tok, hs);
+    }
+}
+
+// Expand a macro at tok, and return the expansion followed by the tokens after the invocation. NULL is returned if tok
+// is not a macro invocation.
+Token *expand_macro(Token *tok) {
+    if (tok->kind != TK_IDENT) {
+        return NULL;
+    }
+    Macro *m = map_find(cc->macros, tok->str);
+    if (!m || hideset_contains(tok->hideset, m->name)) {
+        return NULL;
+    }
+
+    Token head = {};
+    Token *cur = &head;
+    Token *rest;
+    if (!m->is_func) {
+        substitute(m, NULL, hideset_add(tok->hideset, m->name), &cur);
+        rest = tok->next;
+    } else {
+        if (!is_punct(tok->next, PU_LPAREN)) {
+            return NULL;
+        }
+        Token *rparen;
+        MacroArg *args = read_macro_args(m, tok, tok->next, &rparen);
+        HideSet *hs = hideset_add(hideset_intersection(tok->hideset, rparen->hideset), m->name);
+        substitute(m, args, hs, &cur);
+        rest = rparen->next;
+    }
+    if (!head.next) {
+        return rest;
+    }
+    head.next->has_space = tok->has_space;
+    cur->next = rest;
+    return head.next;
+}
+
+Token *preprocess_tokens(Token *tok, Token **cur);
+
+// Return the precedence of a binary operator of #if, or 0 if a token is not one. A higher one binds tighter.
+int binary_precedence(Token *tok) {
+    if (tok->kind != TK_RESERVED) {
+        return 0;
+    }
+    switch (tok->id) {
+        case PU_STAR:
+        case PU_SLASH:
+        case PU_MOD:
+            return 10;
+        case PU_PLUS:
+        case PU_MINUS:
+            return 9;
+        case PU_SHL:
+        case PU_SHR:
+            return 8;
+        case PU_LT:
+        case PU_GT:
+        case PU_LE:
+        case PU_GE:
+            return 7;
+        case PU_EQ:
+        case PU_NE:
+            return 6;
+        case PU_AMP:
+            return 5;
+        case PU_XOR:
+            return 4;
+        case PU_OR:
+            return 3;
+        case PU_LOGAND:
+            return 2;
+        case PU_LOGOR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+long eval_conditional(bool live);
+
+// Evaluate a unary expression of #if at cc->ctok. Identifiers left after macro expansion are 0.
+long eval_unary(bool live) {
+    Token *tok = cc->ctok;
+    if (consume_id(PU_PLUS)) {
+        return eval_unary(live);
+    }
+    if (consume_id(PU_MINUS)) {
+        return -eval_unary(live);
+    }
+    if (consume_id(PU_TILDE)) {
+        return ~eval_unary(live);
+    }
+    if (consume_id(PU_NOT)) {
+        return !eval_unary(live);
+    }
+    if (consume_id(PU_LPAREN)) {
+        long val = eval_conditional(live);
+        expect_id(PU_RPAREN);
+        return val;
+    }
+    if (consume(TK_NUM)) {
+        return tok->val;
+    }
+    if (tok->kind == TK_IDENT || (tok->kind == TK_RESERVED && isalpha(*tok->str))) {
+        cc->ctok = tok->next;
+        return 0;
+    }
+    if (tok->kind == TK_EOF) {
+        error_at(tok->loc, "expected value in expression");
+    }
+    error_at(tok->loc, "token \"%.*s\" is not valid in preprocessor expressions", tok->len, tok->loc);
+    return 0;
+}
+
+// Evaluate the binary operators of #if whose precedence is min_prec or higher. The operands that are not evaluated
+// because of && or || are parsed with live false, which suppresses errors such as division by zero.
+long eval_binary(int min_prec, bool live) {
+    long lhs = eval_unary(live);
+    for (;;) {
+        Token *op = cc->ctok;
+        int prec = binary_precedence(op);
+        if (prec == 0 || prec < min_prec) {
+            return lhs;
+        }
+        cc->ctok = op->next;
+        bool rhs_live = live && (op->id == PU_LOGAND ? lhs : op->id == PU_LOGOR ? !lhs : true);
+        long rhs = eval_binary(prec + 1, rhs_live);
+        if ((op->id == PU_SLASH || op->id == PU_MOD) && rhs == 0) {
+            if (live) {
+                error_at(op->loc, "division by zero in #if");
+            }
+            rhs = 1;
+        }
+        switch (op->id) {
+            case PU_STAR:
+                lhs = lhs * rhs;
+                break;
+            case PU_SLASH:
+                lhs = lhs / rhs;
+                break;
+            case PU_MOD:
+                lhs = lhs % rhs;
+                break;
+            case PU_PLUS:
+                lhs = lhs + rhs;
+                break;
+            case PU_MINUS:
+                lhs = lhs - rhs;
+                break;
+            case PU_SHL:
+                lhs = rhs < 0 || rhs > 63 ? 0 : lhs << rhs;
+                break;
+            case PU_SHR:
+                lhs = rhs < 0 || rhs > 63 ? (lhs < 0 ? -1 : 0) : lhs >> rhs;
+                break;
+            case PU_LT:
+                lhs = lhs < rhs;
+                break;
+            case PU_GT:
+                lhs = lhs > rhs;
+                break;
+            case PU_LE:
+                lhs = lhs <= rhs;
+                break;
+            case PU_GE:
+                lhs = lhs >= rhs;
+                break;
+            case PU_EQ:
+                lhs = lhs == rhs;
+                break;
+            case PU_NE:
+                lhs = lhs != rhs;
+                break;
+            case PU_AMP:
+                lhs = lhs & rhs;
+                break;
+            case PU_XOR:
+                lhs = lhs ^ rhs;
+                break;
+            case PU_OR:
+                lhs = lhs | rhs;
+                break;
+            case PU_LOGAND:
+                lhs = lhs && rhs;
+                break;
+            case PU_LOGOR:
+                lhs = lhs || rhs;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Evaluate a conditional expression of #if at cc->ctok.
+long eval_conditional(bool live) {
+    long cond = eval_binary(1, live);
+    if (!consume_id(PU_QUESTION)) {
+        return cond;
+    }
+    long then = eval_conditional(live && cond);
+    expect_id(PU_COLON);
+    long els = eval_conditional(live && !cond);
+    return cond ? then : els;
+}
+
+// Evaluate the expression of #if or #elif, where tok is the name of the directive. "defined X" and "defined(X)" are
+// replaced before macros are expanded.
+bool eval_if(Token *tok) {
+    Token *directive = tok;
     Token head = {};
     Token *cur = &head;
+    for (tok = tok->next; !tok->is_bol; tok = tok->next) {
+        if (tok->kind != TK_IDENT || strcmp(tok->str, "defined")) {
+            append_token(&cur, tok, NULL);
+            continue;
+        }
+        Token *op = tok;
+        bool paren = !tok->next->is_bol && is_punct(tok->next, PU_LPAREN);
+        tok = paren ? tok->next->next : tok->next;
+        if (tok->is_bol || tok->kind != TK_IDENT) {
+            error_at(op->loc, "operator \"defined\" requires an identifier");
+        }
+        append_token(&cur, op, NULL);
+        cur->kind = TK_NUM;
+        cur->val = map_find(cc->macros, tok->str) != NULL;
+        if (paren) {
+            tok = tok->next;
+            if (tok->is_bol || !is_punct(tok, PU_RPAREN)) {
+                error_at(op->loc, "missing ')' after \"defined\"");
+            }
+        }
+    }
+    if (!head.next) {
+        error_at(directive->loc, "#%s with no expression", directive->str);
+    }
+    cur->next = new_eof(cur);
+
+    cc->ctok = expand_tokens(head.next);
+    long val = eval_conditional(true);
+    if (!at_eof()) {
+        error_at(cc->ctok->loc, "missing binary operator before token \"%.*s\"", cc->ctok->len, cc->ctok->loc);
+    }
+    return val;
+}
+
+// Process a conditional from "#" of #if, #ifdef, or #ifndef to #endif, and include the first group whose condition
+// holds. Return the token after #endif.
+Token *include_conditional(Token *hash, Token **cur) {
+    Token *start = hash;
+    bool included = false;
+    bool has_else = false;
+    for (;;) {
+        Token *tok = hash->next;
+        if (!strcmp(tok->str, "endif")) {
+            return skip_line(tok);
+        }
+        if (has_else) {
+            error_at(tok->loc, "#%s after #else", tok->str);
+        }
+        has_else = !strcmp(tok->str, "else");
+
+        bool cond;
+        if (included) {
+            cond = false;
+        } else if (has_else) {
+            cond = true;
+        } else if (!strcmp(tok->str, "ifdef") || !strcmp(tok->str, "ifndef")) {
+            Token *name = tok->next;
+            if (name->is_bol || name->kind != TK_IDENT) {
+                error_at(tok->loc, "no macro name given in #%s directive", tok->str);
+            }
+            cond = (map_find(cc->macros, name->str) != NULL) == !strcmp(tok->str, "ifdef");
+        } else {
+            cond = eval_if(tok);
+        }
+        if (cond && hash->group) {
+            preprocess_tokens(group_tokens(hash->group), cur);
+        }
+        included |= cond;
+
+        // The tokenizer has stopped the group at the next directive of the conditional.
+        hash = skip_line(tok);
+        if (hash->kind == TK_EOF) {
+            error_at(start->next->loc, "unterminated #%s", start->next->str);
+        }
+    }
+}
 
+// Process #include, where tok is the token after "include". Return the token after the directive.
+Token *include_file(Token *tok, Token **cur) {
+    Token *directive = tok;
+    tok = tok->next;
+    char *name = NULL;
+    bool quoted = tok->kind == TK_STR;
+    if (tok->is_bol) {
+        error_at(directive->loc, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+    if (quoted) {
+        name = tok->str;
+        tok = tok->next;
+    } else if (tok->kind == TK_RESERVED && tok->id == PU_LT) {
+        // The name is spelled as is between "<" and ">".
+        Token *end = tok->next;
+        while (!end->is_bol && !(end->kind == TK_RESERVED && end->id == PU_GT)) {
+            end = end->next;
+        }
+        if (end->is_bol) {
+            error_at(tok->loc, "missing terminating '>' character");
+        }
+        int len = end->loc - tok->loc - 1;
+        name = arena_alloc(&cc->token_arena, len + 1, AK_STRING);
+        memcpy(name, tok->loc + 1, len);
+        tok = end->next;
+    } else {
+        error_at(tok->loc, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+    if (!tok->is_bol) {
+        error_at(tok->loc, "extra tokens at end of #include directive");
+    }
+
+    bool seen;
+    Header *h = find_header(name, quoted, directive->file, &seen);
+    if (!h) {
+        error_at(directive->next->loc, "%s: No such file or directory", name);
+    }
+    if ((h->once && seen) || (h->guard && map_find(cc->macros, h->guard)) || h->in_pch) {
+        return tok;
+    }
+    if (cc->include_depth == MAX_INCLUDE_DEPTH) {
+        error_at(directive->loc, "#include nested depth %d exceeds maximum of %d", cc->include_depth + 1,
+                 MAX_INCLUDE_DEPTH);
+    }
+    cc->include_depth++;
+    preprocess_tokens(copy_tokens(h->body, h->end), cur);
+    cc->include_depth--;
+    return tok;
+}
+
+// Append the tokens from tok to EOF to *cur with directives processed, and return EOF. *cur is updated to the last
+// appended token.
+Token *preprocess_tokens(Token *tok, Token **cur) {
     while (tok->kind != TK_EOF) {
         if (!is_hash(tok)) {
-            cur = cur->next = tok;
+            Token *expanded = expand_macro(tok);
+            if (expanded) {
+                tok = expanded;
+                continue;
+            }
+            *cur = (*cur)->next = tok;
             tok = tok->next;
             continue;
         }
 
+        Token *hash = tok;
         tok = tok->next;
 
         if (tok->is_bol) {
             continue;
         }
 
+        if (!strcmp(tok->str, "define")) {
+            tok = define_macro(hash);
+            continue;
+        }
+
+        if (!strcmp(tok->str, "undef")) {
+            tok = undef_macro(tok);
+            continue;
+        }
+
+        if (!strcmp(tok->str, "include")) {
+            tok = include_file(tok, cur);
+            continue;
+        }
+
+        if (!strcmp(tok->str, "if") || !strcmp(tok->str, "ifdef") || !strcmp(tok->str, "ifndef")) {
+            tok = include_conditional(hash, cur);
+            continue;
+        }
+
+        if (!strcmp(tok->str, "elif") || !strcmp(tok->str, "else") || !strcmp(tok->str, "endif")) {
+            error_at(tok->loc, "#%s without #if", tok->str);
+        }
+
+        // #pragma once has been handled when the file was read, and the other pragmas are ignored.
+        if (!strcmp(tok->str, "pragma")) {
+            tok = skip_line(tok);
+            continue;
+        }
+
         error_at(tok->loc, "invalid preprocessor directive '#%s'", tok->str);
     }
+    return tok;
+}
 
-    cur->next = tok;
+Token *preprocess(Token *tok) {
+    cc->includes = map_create();
+    cc->missing = map_create();
+    cc->macros = map_create();
+    cc->scratch = vec_create();
+
+    Token head = {};
+    Token *cur = &head;
+    Token *eof = preprocess_tokens(tok, &cur);
+    cur->next = eof;
     return head.next;
 }
@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L  // lstat
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "10cc.h"
+
+// A compile server stays resident, and compiles sources sent by clients over a Unix-domain socket. Each connection
+// carries one job as a sequence of length-prefixed messages:
+//
+//   request:  name, source, codegen_jobs (4 bytes), working directory, number of include paths (4 bytes),
+//             include paths
+//   response: status (4 bytes; 0 on success), assembly code, diagnostics
+//
+// Each server thread accepts connections one after another, so that later jobs on the thread reuse its interned
+// strings, canonical types, and included files, which are dropped when they exceed THREAD_STATE_LIMIT. Successful results are also kept in a cache keyed by the hash of the
+// request, and a result is reused only while none of the files that it included has changed, and no file has been
+// created where #include looked for one and found none.
+
+typedef struct CacheEntry CacheEntry;
+
+struct CacheEntry {
+    CacheEntry *next;  // Next entry in the same slot
+    uint64_t hash;
+    char *req;  // Request except codegen_jobs
+    size_t req_size;
+    char *asm_code;
+    size_t asm_size;
+    FileStamp *deps;  // Files that the result depends on (see dependencies())
+    int num_deps;
+};
+
+#define RESULT_CACHE_SLOTS 4096
+
+size_t RESULT_CACHE_LIMIT = 256 << 20;  // Bytes of requests and assembly code that the cache holds at most
+uint32_t MSG_SIZE_LIMIT = 256 << 20;    // Bytes of a message that a peer may send at most
+uint32_t INCLUDE_PATHS_LIMIT = 1024;    // Include paths of a request at most
+size_t THREAD_STATE_LIMIT = 64 << 20;   // Bytes of interned strings, types, and headers that a thread keeps at most
+
+CacheEntry *result_cache[RESULT_CACHE_SLOTS];
+size_t result_cache_size;  // Bytes of requests and assembly code in the cache
+pthread_mutex_t result_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char *server_cache_dir;   // Directory of the on-disk output cache for jobs, or NULL
+uint32_t server_threads;  // Number of server threads, which is also the most threads that a job may use
+
+// Write all bytes to a socket. Return false if the peer is gone.
+bool write_all(int fd, void *data, size_t size) {
+    for (size_t off = 0; off < size;) {
+        ssize_t n = send(fd, (char *)data + off, size - off, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Read exactly size bytes from a socket. Return false if the peer is gone.
+bool read_all(int fd, void *data, size_t size) {
+    for (size_t off = 0; off < size;) {
+        ssize_t n = read(fd, (char *)data + off, size - off);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Write a 4-byte integer.
+bool write_u32(int fd, uint32_t val) { return write_all(fd, &val, sizeof(val)); }
+
+// Read a 4-byte integer.
+bool read_u32(int fd, uint32_t *val) { return read_all(fd, val, sizeof(*val)); }
+
+// Write a length-prefixed message.
+bool write_msg(int fd, char *data, size_t size) { return write_u32(fd, size) && write_all(fd, data, size); }
+
+// Read a length-prefixed message into a NUL-terminated buffer. Return NULL if the peer is gone or the message is longer
+// than MSG_SIZE_LIMIT.
+char *read_msg(int fd, size_t *size) {
+    uint32_t len;
+    if (!read_u32(fd, &len) || len > MSG_SIZE_LIMIT) {
+        return NULL;
+    }
+    char *data = malloc((size_t)len + 1);
+    if (!data || !read_all(fd, data, len)) {
+        free(data);
+        return NULL;
+    }
+    data[len] = '\0';
+    *size = len;
+    return data;
+}
+
+// Connect to a server.
+int connect_server(char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        error("socket path too long: %s", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        error("cannot connect to %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+// Look up the cache for the result of a request. On a hit, a copy of the assembly code is returned.
+char *cache_find(uint64_t hash, char *req, size_t req_size, size_t *asm_size) {
+    char *asm_code = NULL;
+    pthread_mutex_lock(&result_cache_lock);
+    for (CacheEntry *e = result_cache[hash % RESULT_CACHE_SLOTS]; e; e = e->next) {
+        if (e->hash != hash || e->req_size != req_size || memcmp(e->req, req, req_size)) {
+            continue;
+        }
+        bool changed = false;
+        for (int i = 0; i < e->num_deps && !changed; i++) {
+            changed = is_file_changed(&e->deps[i]);
+        }
+        if (!changed) {
+            asm_code = malloc(e->asm_size + 1);
+            memcpy(asm_code, e->asm_code, e->asm_size + 1);
+            *asm_size = e->asm_size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&result_cache_lock);
+    return asm_code;
+}
+
+// Free the files that a compilation included.
+void free_deps(FileStamp *deps, int num_deps) {
+    for (int i = 0; i < num_deps; i++) {
+        free(deps[i].path);
+    }
+    free(deps);
+}
+
+// Add the result of a request to the cache. The cache takes deps over. When the cache is full, it is emptied first.
+void cache_insert(uint64_t hash, char *req, size_t req_size, char *asm_code, size_t asm_size, FileStamp *deps,
+                  int num_deps) {
+    CacheEntry *entry = malloc(sizeof(CacheEntry));
+    entry->hash = hash;
+    entry->req = malloc(req_size);
+    memcpy(entry->req, req, req_size);
+    entry->req_size = req_size;
+    entry->asm_code = malloc(asm_size + 1);
+    memcpy(entry->asm_code, asm_code, asm_size + 1);
+    entry->asm_size = asm_size;
+    entry->deps = deps;
+    entry->num_deps = num_deps;
+
+    pthread_mutex_lock(&result_cache_lock);
+    if (result_cache_size + req_size + asm_size > RESULT_CACHE_LIMIT) {
+        for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+            while (result_cache[i]) {
+                CacheEntry *e = result_cache[i];
+                result_cache[i] = e->next;
+                free(e->req);
+                free(e->asm_code);
+                free_deps(e->deps, e->num_deps);
+                free(e);
+            }
+        }
+        result_cache_size = 0;
+    }
+    entry->next = result_cache[hash % RESULT_CACHE_SLOTS];
+    result_cache[hash % RESULT_CACHE_SLOTS] = entry;
+    result_cache_size += req_size + asm_size;
+    pthread_mutex_unlock(&result_cache_lock);
+}
+
+// Append a diagnostic to the buffer passed as data.
+void collect_diagnostic(TenccDiagnostic *diag, void *data) {
+    char *text = format_diagnostic(diag);
+    buf_append(data, text, strlen(text));
+    free(text);
+}
+
+// Serve a job on a connection.
+void serve_job(int fd) {
+    // Everything in the request but codegen_jobs is kept in req, which is the key of the result cache.
+    Buffer *req = buf_create();
+    size_t name_size, src_size, dir_size;
+    char *name = read_msg(fd, &name_size);
+    char *src = name ? read_msg(fd, &src_size) : NULL;
+    uint32_t codegen_jobs, num_include_paths;
+    char *dir = src && read_u32(fd, &codegen_jobs) ? read_msg(fd, &dir_size) : NULL;
+    char **include_paths = NULL;
+    bool ok = dir && read_u32(fd, &num_include_paths) && num_include_paths <= INCLUDE_PATHS_LIMIT;
+    if (ok) {
+        buf_append(req, name, name_size + 1);
+        buf_append(req, dir, dir_size + 1);
+        include_paths = calloc(num_include_paths + 1, sizeof(char *));
+        for (uint32_t i = 0; i < num_include_paths && ok; i++) {
+            size_t path_size;
+            include_paths[i] = read_msg(fd, &path_size);
+            ok = include_paths[i];
+            if (ok) {
+                buf_append(req, include_paths[i], path_size + 1);
+            }
+        }
+        buf_append(req, src, src_size);
+    }
+
+    if (ok) {
+        codegen_jobs = codegen_jobs < 1 ? 1 : codegen_jobs > server_threads ? server_threads : codegen_jobs;
+        uint64_t hash = hash64(HASH64_INIT, req->data, req->len);
+        size_t asm_size;
+        char *asm_code = cache_find(hash, req->data, req->len, &asm_size);
+        Buffer *diags = buf_create();
+        int status = 0;
+        if (!asm_code) {
+            TenccOptions opts = {
+                .codegen_jobs = codegen_jobs,
+                .on_diagnostic = collect_diagnostic,
+                .diagnostic_data = diags,
+                .cache_dir = server_cache_dir,
+                .include_paths = include_paths,
+                .num_include_paths = num_include_paths,
+                .working_dir = dir,
+            };
+            FileStamp *deps;
+            int num_deps;
+            status = compile_source(name, src, src_size, &opts, &asm_code, &asm_size, &deps, &num_deps);
+            if (!status) {
+                cache_insert(hash, req->data, req->len, asm_code, asm_size, deps, num_deps);
+            }
+        }
+
+        if (write_u32(fd, status) && write_msg(fd, status ? "" : asm_code, status ? 0 : asm_size)) {
+            write_msg(fd, diags->data, diags->len);
+        }
+        if (!status) {
+            free(asm_code);
+        }
+        buf_free(diags);
+    }
+
+    for (int i = 0; include_paths && include_paths[i]; i++) {
+        free(include_paths[i]);
+    }
+    free(include_paths);
+    buf_free(req);
+    free(name);
+    free(src);
+    free(dir);
+}
+
+// Accept and serve connections forever.
+void *server_thread(void *arg) {
+    int sock = *(int *)arg;
+    for (;;) {
+        int fd = accept(sock, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+        serve_job(fd);
+        close(fd);
+
+        // Like the result cache, what the jobs on this thread share is emptied when it grows too large.
+        if (interned_size() + type_arena.reserved + header_cache_size() > THREAD_STATE_LIMIT) {
+            release_headers();
+            release_types();
+            release_interned();
+        }
+    }
+}
+
+// Listen on a Unix-domain socket at a given path, and serve jobs on num_threads threads. This never returns.
+void serve(char *path, int num_threads, char *cache_dir) {
+    server_cache_dir = cache_dir;
+    server_threads = num_threads;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        error("socket path too long: %s", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    // Remove the socket left by a previous server, but nothing else that happens to be at the path.
+    struct stat st;
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            error("cannot listen on %s: not a socket", path);
+        }
+        unlink(path);
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(sock, 128) == -1) {
+        error("cannot listen on %s: %s", path, strerror(errno));
+    }
+
+    // The main thread is one of the server threads.
+    for (int i = 1; i < num_threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server_thread, &sock)) {
+            error("cannot create a thread");
+        }
+    }
+    server_thread(&sock);
+}
+
+// Compile a source on a server with codegen_jobs and include_paths of opts. Relative paths are resolved against the
+// current directory of the client. Diagnostics are printed to the standard error. On success, 0 is returned, and the
+// assembly code is stored as tencc_compile() does.
+int remote_compile(char *path, char *name, char *src, size_t size, TenccOptions *opts, char **asm_out,
+                   size_t *asm_size) {
+    char dir[4096];
+    if (!getcwd(dir, sizeof(dir))) {
+        error("getcwd: %s", strerror(errno));
+    }
+
+    int fd = connect_server(path);
+    bool ok = write_msg(fd, name, strlen(name)) && write_msg(fd, src, size) && write_u32(fd, opts->codegen_jobs) &&
+              write_msg(fd, dir, strlen(dir)) && write_u32(fd, opts->num_include_paths);
+    for (int i = 0; i < opts->num_include_paths && ok; i++) {
+        ok = write_msg(fd, opts->include_paths[i], strlen(opts->include_paths[i]));
+    }
+    if (!ok) {
+        error("%s: lost connection to the server", path);
+    }
+
+    uint32_t status;
+    size_t diags_size;
+    char *diags = NULL;
+    if (!read_u32(fd, &status) || !(*asm_out = read_msg(fd, asm_size)) || !(diags = read_msg(fd, &diags_size))) {
+        error("%s: lost connection to the server", path);
+    }
+    close(fd);
+
+    fwrite(diags, 1, diags_size, stderr);
+    free(diags);
+    if (status) {
+        free(*asm_out);
+        return -1;
+    }
+    return 0;
+}
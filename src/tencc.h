@@ -0,0 +1,61 @@
+// The library interface of 10cc (libtencc.a).
+//
+// A program links libtencc.a (and -pthread) and calls tencc_compile() to compile C source code in memory into x86-64
+// assembly code in memory. tencc_compile() can be called any number of times, and from several threads at once. Each
+// call releases everything it allocated except the returned assembly code, and a few strings and types that the
+// calling thread keeps for later calls.
+#ifndef TENCC_H
+#define TENCC_H
+
+#include <stddef.h>
+
+#define TENCC_VERSION "0.1.0"
+
+typedef struct TenccDiagnostic TenccDiagnostic;
+typedef struct TenccOptions TenccOptions;
+
+// A diagnostic reported by a compilation.
+struct TenccDiagnostic {
+    char *file;     // Name of the source file, or NULL if the diagnostic is not about a location in source code
+    int line;       // 1-origin line number of the location
+    int col;        // 1-origin column number of the location
+    char *text;     // Text of the line of the location, which is not NUL-terminated
+    int text_len;   // Length of text
+    char *message;  // Error message
+};
+
+// A function that receives diagnostics. It is called on the thread that calls tencc_compile() or one of the threads
+// that the compilation started, but never concurrently for a single compilation. The diagnostic is valid only during
+// the call.
+typedef void (*TenccDiagnosticHandler)(TenccDiagnostic *diag, void *data);
+
+struct TenccOptions {
+    int codegen_jobs;                      // Maximum number of threads that generate code; 0 means 1
+    TenccDiagnosticHandler on_diagnostic;  // NULL discards diagnostics
+    void *diagnostic_data;                 // Passed to on_diagnostic as is
+    char *cache_dir;                       // Directory of the on-disk output cache, or NULL not to use it
+    int incremental;                       // Nonzero to also cache the code of each function in cache_dir
+    char **include_paths;                  // Directories that #include searches, in order
+    int num_include_paths;                 // Number of include_paths
+    char *working_dir;                     // Directory that relative paths are resolved against; NULL means the
+                                           // current directory
+    char *emit_pch;                        // Path to write a precompiled header of the declarations and macros of
+                                           // the source to, or NULL. The source must have no function definitions,
+                                           // and the assembly code is empty.
+    char *include_pch;                     // Path of a precompiled header to start from as if it were included
+                                           // first, or NULL
+    int time_report;                       // Nonzero to print the time of each phase and the numbers of tokens, AST
+                                           // nodes, and functions to stderr
+    int mem_report;                        // Nonzero to print the number and bytes of the allocations of each kind of
+                                           // object and the peak RSS to stderr
+    char *time_trace;                      // Path to write a Chrome trace of the phases and of each function in them
+                                           // to, or NULL
+};
+
+// Compile size bytes of source code. name is used in diagnostics, and opts can be NULL for the default options.
+// On success, 0 is returned, and a malloc'ed NUL-terminated string of assembly code is stored into *asm_out (and its
+// length into *asm_size unless asm_size is NULL). On error, the error is reported to the diagnostic handler, and -1 is
+// returned. A compilation stops at its first error.
+int tencc_compile(char *name, char *src, size_t size, TenccOptions *opts, char **asm_out, size_t *asm_size);
+
+#endif
@@ -1,88 +1,317 @@
 #include "10cc.h"
 
-Token *ctok;
+// Return the current token if it is of the given kind. Otherwise, NULL will be returned.
+Token *peek(TokenKind kind) { return cc->ctok->kind == kind ? cc->ctok : NULL; }
 
-bool is_bol = true;  // true if `cur` is at beginning of a line
+// Pop the current token if it is of the given kind. Otherwise, NULL will be returned.
+Token *consume(TokenKind kind) {
+    Token *tok = peek(kind);
+    if (tok) {
+        cc->ctok = cc->ctok->next;
+    }
+    return tok;
+}
 
-// Return the current token if it satisfies the given conditions. Otherwise, NULL will be returned.
-Token *peek(TokenKind kind, char *str) {
-    if (ctok->kind != kind || (str && strcmp(ctok->str, str))) {
-        return NULL;
+// Pop the current token if it is of the given kind. Otherwise, raise an error.
+Token *expect(TokenKind kind) {
+    Token *tok = peek(kind);
+    if (!tok) {
+        char *str = NULL;
+        switch (kind) {
+            case TK_RESERVED:
+                str = "reserved token";
+                break;
+            case TK_IDENT:
+                str = "identifier";
+                break;
+            case TK_NUM:
+                str = "number";
+                break;
+            case TK_STR:
+                str = "string literal";
+                break;
+            case TK_EOF:
+                str = "EOF";
+                break;
+        }
+        error_at(cc->ctok->loc, "expected '%s' before '%s' token", str, cc->ctok->str);
     }
-    return ctok;
+    cc->ctok = cc->ctok->next;
+    return tok;
 }
 
-// Pop the current token if it satisfies the given conditions. Otherwise, NULL will be returned.
-Token *consume(TokenKind kind, char *str) {
-    Token *tok = peek(kind, str);
+// Return the current token if it is the given keyword or punctuator. Otherwise, NULL will be returned.
+Token *peek_id(ReservedId id) { return cc->ctok->kind == TK_RESERVED && cc->ctok->id == id ? cc->ctok : NULL; }
+
+// Pop the current token if it is the given keyword or punctuator. Otherwise, NULL will be returned.
+Token *consume_id(ReservedId id) {
+    Token *tok = peek_id(id);
     if (tok) {
-        ctok = ctok->next;
+        cc->ctok = cc->ctok->next;
     }
     return tok;
 }
 
-// Pop the current token if it satisfies the given conditions. Otherwise, raise an error.
-Token *expect(TokenKind kind, char *str) {
-    Token *tok = peek(kind, str);
+// Pop the current token if it is the given keyword or punctuator. Otherwise, raise an error.
+Token *expect_id(ReservedId id) {
+    Token *tok = peek_id(id);
     if (!tok) {
-        if (!str) {
-            switch (kind) {
-                case TK_RESERVED:
-                    str = "reserved token";
-                    break;
-                case TK_IDENT:
-                    str = "identifier";
-                    break;
-                case TK_NUM:
-                    str = "number";
-                    break;
-                case TK_STR:
-                    str = "string literal";
-                    break;
-                case TK_CHAR:
-                    str = "char literal";
-                    break;
-                case TK_EOF:
-                    str = "EOF";
-                    break;
-            }
-        }
-        error_at(ctok->loc, "expected '%s' before '%s' token", str, ctok->str);
+        error_at(cc->ctok->loc, "expected '%s' before '%s' token", reserved_str[id], cc->ctok->str);
     }
-    ctok = ctok->next;
+    cc->ctok = cc->ctok->next;
     return tok;
 }
 
 // Return true if the kind of the current token is EOF.
-bool at_eof() { return peek(TK_EOF, NULL); }
+bool at_eof() { return peek(TK_EOF); }
 
-// Read an reserved keyword.
-char *read_reserved(char *p) {
-    // Keywords.
-    char *kws[] = {"return",  "if",     "else", "while", "for",  "break", "continue", "struct", "enum",
-                   "typedef", "sizeof", "void", "_Bool", "char", "short", "int",      "long"};
-    for (int i = 0; i < sizeof(kws) / sizeof(kws[0]); i++) {
-        int len = strlen(kws[i]);
-        if (startswith(p, kws[i]) && !(isalnum(p[len]) || p[len] == '_')) {
-            return kws[i];
-        }
-    }
-    // Multi-character operations
-    char *multi_ops[] = {"<=", ">=", "==", "!=", "++", "--", "+=", "-=", "*=", "/=", "->"};
-    for (int i = 0; i < sizeof(multi_ops) / sizeof(multi_ops[0]); i++) {
-        if (startswith(p, multi_ops[i])) {
-            return multi_ops[i];
-        }
+// Spellings of reserved tokens, indexed by ReservedId.
+char *reserved_str[NUM_RESERVED] = {
+    [KW_RETURN] = "return",
+    [KW_IF] = "if",
+    [KW_ELSE] = "else",
+    [KW_WHILE] = "while",
+    [KW_FOR] = "for",
+    [KW_BREAK] = "break",
+    [KW_CONTINUE] = "continue",
+    [KW_STRUCT] = "struct",
+    [KW_ENUM] = "enum",
+    [KW_TYPEDEF] = "typedef",
+    [KW_SIZEOF] = "sizeof",
+    [KW_VOID] = "void",
+    [KW_BOOL] = "_Bool",
+    [KW_CHAR] = "char",
+    [KW_SHORT] = "short",
+    [KW_INT] = "int",
+    [KW_LONG] = "long",
+    [PU_LE] = "<=",
+    [PU_GE] = ">=",
+    [PU_EQ] = "==",
+    [PU_NE] = "!=",
+    [PU_INC] = "++",
+    [PU_DEC] = "--",
+    [PU_ADD_ASSIGN] = "+=",
+    [PU_SUB_ASSIGN] = "-=",
+    [PU_MUL_ASSIGN] = "*=",
+    [PU_DIV_ASSIGN] = "/=",
+    [PU_ARROW] = "->",
+    [PU_PLUS] = "+",
+    [PU_MINUS] = "-",
+    [PU_STAR] = "*",
+    [PU_SLASH] = "/",
+    [PU_LPAREN] = "(",
+    [PU_RPAREN] = ")",
+    [PU_LT] = "<",
+    [PU_GT] = ">",
+    [PU_ASSIGN] = "=",
+    [PU_SEMICOLON] = ";",
+    [PU_LBRACE] = "{",
+    [PU_RBRACE] = "}",
+    [PU_COMMA] = ",",
+    [PU_LBRACKET] = "[",
+    [PU_RBRACKET] = "]",
+    [PU_AMP] = "&",
+    [PU_DOT] = ".",
+    [PU_COLON] = ":",
+    [PU_NOT] = "!",
+    [PU_QUESTION] = "?",
+    [PU_TILDE] = "~",
+    [PU_HASH] = "#",
+    [PU_HASHHASH] = "##",
+    [PU_MOD] = "%",
+    [PU_SHL] = "<<",
+    [PU_SHR] = ">>",
+    [PU_OR] = "|",
+    [PU_XOR] = "^",
+    [PU_LOGAND] = "&&",
+    [PU_LOGOR] = "||",
+};
+
+// A perfect hash function over the keywords. It maps each keyword to a distinct slot of `keywords`, which is checked
+// at compile time: the Makefile builds this file with -Werror=override-init, which rejects two initializers below
+// that designate the same slot.
+#define KW_HASH(first, last, len) (((first) + (last)*25 + (len)) & 31)
+
+typedef struct {
+    char *name;
+    ReservedId id;
+} Keyword;
+
+Keyword keywords[32] = {
+    [KW_HASH('r', 'n', 6)] = {"return", KW_RETURN},
+    [KW_HASH('i', 'f', 2)] = {"if", KW_IF},
+    [KW_HASH('e', 'e', 4)] = {"else", KW_ELSE},
+    [KW_HASH('w', 'e', 5)] = {"while", KW_WHILE},
+    [KW_HASH('f', 'r', 3)] = {"for", KW_FOR},
+    [KW_HASH('b', 'k', 5)] = {"break", KW_BREAK},
+    [KW_HASH('c', 'e', 8)] = {"continue", KW_CONTINUE},
+    [KW_HASH('s', 't', 6)] = {"struct", KW_STRUCT},
+    [KW_HASH('e', 'm', 4)] = {"enum", KW_ENUM},
+    [KW_HASH('t', 'f', 7)] = {"typedef", KW_TYPEDEF},
+    [KW_HASH('s', 'f', 6)] = {"sizeof", KW_SIZEOF},
+    [KW_HASH('v', 'd', 4)] = {"void", KW_VOID},
+    [KW_HASH('_', 'l', 5)] = {"_Bool", KW_BOOL},
+    [KW_HASH('c', 'r', 4)] = {"char", KW_CHAR},
+    [KW_HASH('s', 't', 5)] = {"short", KW_SHORT},
+    [KW_HASH('i', 't', 3)] = {"int", KW_INT},
+    [KW_HASH('l', 'g', 4)] = {"long", KW_LONG},
+};
+
+// Classify an identifier of the given length. Return its keyword ID, or -1 if it is not a keyword.
+int read_keyword(char *p, int len) {
+    Keyword *kw = &keywords[KW_HASH(p[0], p[len - 1], len)];
+    if (kw->name && !strncmp(kw->name, p, len) && !kw->name[len]) {
+        return kw->id;
     }
-    // Single-character operations
-    char *single_ops[] = {"+", "-", "*", "/", "(", ")", "<", ">", "=", ";", "{", "}",
-                          ",", "[", "]", "&", ".", ",", ":", "!", "?", "~", "#"};
-    for (int i = 0; i < sizeof(single_ops) / sizeof(single_ops[0]); i++) {
-        if (startswith(p, single_ops[i])) {
-            return single_ops[i];
-        }
+    return -1;
+}
+
+// Read a punctuator, and return its ID. If there is no punctuator at p, return -1.
+int read_punct(char **p) {
+    char *s = *p;
+    switch (s[0]) {
+        case '+':
+            if (s[1] == '+') {
+                *p += 2;
+                return PU_INC;
+            }
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_ADD_ASSIGN;
+            }
+            *p += 1;
+            return PU_PLUS;
+        case '-':
+            if (s[1] == '-') {
+                *p += 2;
+                return PU_DEC;
+            }
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_SUB_ASSIGN;
+            }
+            if (s[1] == '>') {
+                *p += 2;
+                return PU_ARROW;
+            }
+            *p += 1;
+            return PU_MINUS;
+        case '*':
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_MUL_ASSIGN;
+            }
+            *p += 1;
+            return PU_STAR;
+        case '/':
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_DIV_ASSIGN;
+            }
+            *p += 1;
+            return PU_SLASH;
+        case '<':
+            if (s[1] == '<') {
+                *p += 2;
+                return PU_SHL;
+            }
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_LE;
+            }
+            *p += 1;
+            return PU_LT;
+        case '>':
+            if (s[1] == '>') {
+                *p += 2;
+                return PU_SHR;
+            }
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_GE;
+            }
+            *p += 1;
+            return PU_GT;
+        case '=':
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_EQ;
+            }
+            *p += 1;
+            return PU_ASSIGN;
+        case '!':
+            if (s[1] == '=') {
+                *p += 2;
+                return PU_NE;
+            }
+            *p += 1;
+            return PU_NOT;
+        case '(':
+            *p += 1;
+            return PU_LPAREN;
+        case ')':
+            *p += 1;
+            return PU_RPAREN;
+        case ';':
+            *p += 1;
+            return PU_SEMICOLON;
+        case '{':
+            *p += 1;
+            return PU_LBRACE;
+        case '}':
+            *p += 1;
+            return PU_RBRACE;
+        case ',':
+            *p += 1;
+            return PU_COMMA;
+        case '[':
+            *p += 1;
+            return PU_LBRACKET;
+        case ']':
+            *p += 1;
+            return PU_RBRACKET;
+        case '&':
+            if (s[1] == '&') {
+                *p += 2;
+                return PU_LOGAND;
+            }
+            *p += 1;
+            return PU_AMP;
+        case '|':
+            if (s[1] == '|') {
+                *p += 2;
+                return PU_LOGOR;
+            }
+            *p += 1;
+            return PU_OR;
+        case '^':
+            *p += 1;
+            return PU_XOR;
+        case '%':
+            *p += 1;
+            return PU_MOD;
+        case '.':
+            *p += 1;
+            return PU_DOT;
+        case ':':
+            *p += 1;
+            return PU_COLON;
+        case '?':
+            *p += 1;
+            return PU_QUESTION;
+        case '~':
+            *p += 1;
+            return PU_TILDE;
+        case '#':
+            if (s[1] == '#') {
+                *p += 2;
+                return PU_HASHHASH;
+            }
+            *p += 1;
+            return PU_HASH;
+        default:
+            return -1;
     }
-    return NULL;
 }
 
 // Skip a line comment.
@@ -116,7 +345,7 @@ bool skip_newline(char **p) {
         return false;
     }
     (*p)++;
-    is_bol = true;
+    cc->is_bol = true;
     return true;
 }
 
@@ -156,7 +385,15 @@ char get_escape_char(char c) {
 }
 
 char *get_string_literal(char **p) {
-    char *buf = calloc(256, sizeof(char));
+    // The decoded string is never longer than its spelling.
+    char *end = *p + 1;
+    while (*end && *end != '"' && *end != '\n') {
+        end += *end == '\\' && end[1] ? 2 : 1;
+    }
+    if (*end != '"') {
+        error_at(*p, "missing terminating '\"' character");
+    }
+    char *buf = arena_alloc(cc->tok_arena, end - *p, AK_STRING);
     int len = 0;
     (*p)++;  // "
     while (**p != '"') {
@@ -188,92 +425,158 @@ char get_char_literal(char **p) {
     return c;
 }
 
-// Get a string.
-char *get_str(TokenKind kind, char **p) {
-    int len;
-    switch (kind) {
-        case TK_STR:
-            return get_string_literal(p);
-        case TK_RESERVED: {
-            len = strlen(read_reserved(*p));
-            break;
+// Create a token.
+Token *new_token(TokenKind kind, Token *cur, char *loc) {
+    Token *tok = arena_alloc(cc->tok_arena, sizeof(Token), AK_TOKEN);
+    tok->kind = kind;
+    tok->file = cc->tok_file;
+    tok->loc = loc;
+    tok->str = "";
+    tok->is_bol = cc->is_bol;
+    tok->has_space = cc->has_space;
+
+    // Tokens are created in order, so the line index only moves forward.
+    File *file = cc->tok_file;
+    int offset = loc - file->contents;
+    while (cc->line_idx + 1 < file->num_lines && file->lines[cc->line_idx + 1] <= offset) {
+        cc->line_idx++;
+    }
+    tok->line = cc->line_idx + 1;
+    tok->col = offset - file->lines[cc->line_idx] + 1;
+    cur->next = tok;
+    cc->is_bol = cc->has_space = false;
+    return tok;
+}
+
+// Return true if a token names a directive that controls the lines after it.
+bool is_conditional(Token *tok) {
+    return !strcmp(tok->str, "if") || !strcmp(tok->str, "ifdef") || !strcmp(tok->str, "ifndef") ||
+           !strcmp(tok->str, "elif") || !strcmp(tok->str, "else");
+}
+
+// Skip the lines of a group from p, which is at the beginning of a line, and return the beginning of the line of the
+// next #elif, #else, or #endif of the same nesting level, or end. Only "#" at the beginning of a line is looked at,
+// and the rest of a line is skipped over except for comments and literals, which may hide a "#" or a new line.
+char *skip_group(char *p, char *end) {
+    int depth = 0;
+    while (p < end) {
+        char *line = p;
+        while (*p == ' ' || *p == '\t') {
+            p++;
         }
-        case TK_IDENT: {
-            len = 1;  // the first character has been verified in tokenize().
-            while (isalnum((*p)[len]) || (*p)[len] == '_') {
-                len++;
+        if (*p == '#') {
+            p++;
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+            char *name = p;
+            while (isalnum(*p) || *p == '_') {
+                p++;
+            }
+            int len = p - name;
+            if ((len == 2 && !strncmp(name, "if", 2)) || (len == 5 && !strncmp(name, "ifdef", 5)) ||
+                (len == 6 && !strncmp(name, "ifndef", 6))) {
+                depth++;
+            } else if (len == 5 && !strncmp(name, "endif", 5)) {
+                if (depth-- == 0) {
+                    return line;
+                }
+            } else if (depth == 0 && len == 4 && (!strncmp(name, "elif", 4) || !strncmp(name, "else", 4))) {
+                return line;
             }
-            break;
         }
-        default:
-            len = 0;
-            break;
-    }
-    char *buf = calloc(256, sizeof(char));
-    strncpy(buf, *p, len);
-    buf[len] = '\0';
-    *p += len;
-    return buf;
-}
 
-// Get a value.
-long get_val(TokenKind kind, char **p) {
-    switch (kind) {
-        case TK_NUM:
-            return strtol(*p, p, 10);
-        case TK_CHAR:
-            return get_char_literal(p);
-        default:
-            return 0;
+        while (*(p += strcspn(p, "\n/\"'")) && *p != '\n') {
+            if (p[0] == '/' && p[1] == '/') {
+                p = strchr(p, '\n');
+            } else if (p[0] == '/' && p[1] == '*') {
+                char *q = strstr(p + 2, "*/");
+                p = q ? q + 2 : p + strlen(p);
+            } else if (*p == '"' || *p == '\'') {
+                char quote = *p++;
+                while (*p && *p != quote && *p != '\n') {
+                    p += *p == '\\' && p[1] && p[1] != '\n' ? 2 : 1;
+                }
+                p += *p == quote;
+            } else {
+                p++;
+            }
+        }
+        p += *p == '\n';
     }
+    return end;
 }
 
-// Create a token.
-Token *new_token(TokenKind kind, Token *cur, char **p) {
-    Token *tok = calloc(1, sizeof(Token));
-    tok->kind = kind == TK_CHAR ? TK_NUM : kind;  // TK_CHAR is treated as TK_NUM during parsing.
-    tok->loc = *p;
-    tok->str = get_str(kind, p);
-    tok->val = get_val(kind, p);
-    tok->is_bol = is_bol;
-    cur->next = tok;
-    is_bol = false;
-    return tok;
+// Tokenize a file. Tokens and string literals are allocated from a given arena.
+Token *tokenize(File *file, Arena *arena) {
+    return tokenize_range(file, file->contents, file->contents + file->size, arena);
 }
 
-// Tokenize a given file.
-Token *tokenize() {
+// Tokenize the part of a file from p, which is at the beginning of a line, to end. The lines that a conditional
+// directive controls are not tokenized, but attached to the "#" of the directive as a Group.
+Token *tokenize_range(File *file, char *p, char *end, Arena *arena) {
     Token head = {};
     Token *cur = &head;
+    Token *cond = NULL;  // "#" of a conditional directive whose lines follow the current line
 
-    char *p = user_input;
+    cc->tok_file = file;
+    cc->tok_arena = arena;
+    cc->line_idx = find_line(file, p);
+    cc->is_bol = true;
+    cc->has_space = false;
 
-    while (*p) {
+    while (p < end) {
         if (skip_line_comment(&p) || skip_block_comment(&p) || skip_newline(&p) || skip_space(&p)) {
+            cc->has_space = true;
+            if (cond && cc->is_bol) {
+                Group *group = arena_alloc(arena, sizeof(Group), AK_OTHER);
+                group->file = file;
+                group->start = p;
+                group->end = p = skip_group(p, end);
+                group->arena = arena;
+                cond->group = group;
+                cond = NULL;
+            }
             continue;
         }
-        if (read_reserved(p)) {
-            cur = new_token(TK_RESERVED, cur, &p);
-            continue;
-        }
-        if (*p == '"') {
-            cur = new_token(TK_STR, cur, &p);
-            continue;
-        }
-        if (*p == '\'') {
-            cur = new_token(TK_CHAR, cur, &p);
-            continue;
-        }
+        Token *prev = cur;
+        char *start = p;
         if (isalpha(*p) || *p == '_') {
-            cur = new_token(TK_IDENT, cur, &p);
-            continue;
+            while (isalnum(*p) || *p == '_') {
+                p++;
+            }
+            int id = read_keyword(start, p - start);
+            if (id != -1) {
+                cur = new_token(TK_RESERVED, cur, start);
+                cur->id = id;
+                cur->str = reserved_str[id];
+            } else {
+                cur = new_token(TK_IDENT, cur, start);
+                cur->str = intern(start, p - start);
+            }
+        } else if (isdigit(*p)) {
+            cur = new_token(TK_NUM, cur, p);
+            cur->val = strtol(p, &p, 10);
+        } else if (*p == '"') {
+            cur = new_token(TK_STR, cur, p);
+            cur->str = get_string_literal(&p);
+        } else if (*p == '\'') {
+            cur = new_token(TK_NUM, cur, p);  // A char literal is treated as a number during parsing.
+            cur->val = get_char_literal(&p);
+        } else {
+            int id = read_punct(&p);
+            if (id == -1) {
+                error_at(p, "stray '%c' in program", *p);
+            }
+            cur = new_token(TK_RESERVED, cur, start);
+            cur->id = id;
+            cur->str = reserved_str[id];
         }
-        if (isdigit(*p)) {
-            cur = new_token(TK_NUM, cur, &p);
-            continue;
+        cur->len = p - start;
+        if (prev->is_bol && prev->kind == TK_RESERVED && prev->id == PU_HASH && !cur->is_bol && is_conditional(cur)) {
+            cond = prev;
         }
-        error_at(p, "stray '%c' in program", *p);
     }
-    new_token(TK_EOF, cur, &p);
+    new_token(TK_EOF, cur, p);
     return head.next;
 }
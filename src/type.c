@@ -166,10 +166,10 @@ Node *do_walk(Node *node, bool decay) {
             if (node->lhs->type->kind != TY_STRUCT) {
                 error_at(node->tok->loc, "member reference base type is not a structure");
             }
-            if (!map_contains(node->lhs->type->members, node->member_name)) {
+            node->member = map_find(node->lhs->type->members, node->member_name);
+            if (!node->member) {
                 error_at(node->tok->loc, "no member named '%s'", node->member_name);
             }
-            node->member = map_at(node->lhs->type->members, node->member_name);
             node->type = node->member->type;
             return node;
         default:
@@ -189,52 +189,85 @@ Prog *assign_type(Prog *prog) {
     for (int i = 0; i < prog->fns->len; i++) {
         Func *fn = vec_at(prog->fns->vals, i);
         if (fn->body) {
+            double begin = trace_begin();
             fn->body = walk(fn->body);
+            trace_end(fn->name, "sema", begin);
         }
     }
     return prog;
 }
 
-// Create a type.
-Type *new_type(TypeKind type, int size) {
-    Type *ret = calloc(1, sizeof(Type));
+// Create a type. Transient types die with the compilation, while the others live as long as the thread.
+Type *new_type(TypeKind type, int size, bool is_transient) {
+    Type *ret = arena_alloc(is_transient ? &cc->ast_arena : &type_arena, sizeof(Type), AK_TYPE);
     ret->kind = type;
     ret->size = size;
+    ret->is_transient = is_transient;
     return ret;
 }
 
-// Create a void type.
-Type *void_type() { return new_type(TY_VOID, 1); }
+// Types are canonical except for struct types: scalar types are singletons, and derived types are interned in their
+// base type. Two types are therefore the same iff their addresses are, and types must never be modified once created.
+// Each thread has its own set of canonical types so that compilations on different threads never share a type.
+_Thread_local Type void_ty = {TY_VOID, 1};
+_Thread_local Type bool_ty = {TY_BOOL, 1};
+_Thread_local Type char_ty = {TY_CHAR, 1};
+_Thread_local Type short_ty = {TY_SHORT, 2};
+_Thread_local Type int_ty = {TY_INT, 4};
+_Thread_local Type long_ty = {TY_LONG, 8};
+_Thread_local Type enum_ty = {TY_ENUM, 4};
 
-// Create a bool type.
-Type *bool_type() { return new_type(TY_BOOL, 1); }
+// Free the canonical types of this thread. No type of the thread may be in use.
+void release_types() {
+    void_ty = (Type){TY_VOID, 1};
+    bool_ty = (Type){TY_BOOL, 1};
+    char_ty = (Type){TY_CHAR, 1};
+    short_ty = (Type){TY_SHORT, 2};
+    int_ty = (Type){TY_INT, 4};
+    long_ty = (Type){TY_LONG, 8};
+    enum_ty = (Type){TY_ENUM, 4};
+    arena_release(&type_arena);
+}
+
+// Return the void type.
+Type *void_type() { return &void_ty; }
 
-// Create a char type.
-Type *char_type() { return new_type(TY_CHAR, 1); }
+// Return the bool type.
+Type *bool_type() { return &bool_ty; }
 
-// Create a short type.
-Type *short_type() { return new_type(TY_SHORT, 2); }
+// Return the char type.
+Type *char_type() { return &char_ty; }
 
-// Create an int type.
-Type *int_type() { return new_type(TY_INT, 4); }
+// Return the short type.
+Type *short_type() { return &short_ty; }
 
-// Create a long type.
-Type *long_type() { return new_type(TY_LONG, 8); }
+// Return the int type.
+Type *int_type() { return &int_ty; }
 
-// Create a pointer type.
+// Return the long type.
+Type *long_type() { return &long_ty; }
+
+// Return the pointer type to a given type.
 Type *ptr_to(Type *base) {
-    Type *type = new_type(TY_PTR, 8);
-    type->base = base;
-    return type;
+    if (!base->ptr) {
+        base->ptr = new_type(TY_PTR, 8, base->is_transient);
+        base->ptr->base = base;
+    }
+    return base->ptr;
 }
 
-// Create an array type.
+// Return the array type of a given type and length.
 Type *ary_of(Type *base, int array_size) {
-    Type *type = calloc(1, sizeof(Type));
-    type->kind = TY_ARY;
-    type->size = base->size * array_size;
+    for (Type *type = base->arys; type; type = type->next_ary) {
+        if (type->array_size == array_size) {
+            return type;
+        }
+    }
+    Type *type = new_type(TY_ARY, base->size * array_size, base->is_transient);
     type->base = base;
     type->array_size = array_size;
+    type->next_ary = base->arys;
+    base->arys = type;
     return type;
 }
 
@@ -242,13 +275,13 @@ Type *ary_of(Type *base, int array_size) {
 Type *struct_type(Map *members) {
     Member *last = vec_back(members->vals);
     int size = last->offset + last->type->size;
-    Type *type = new_type(TY_STRUCT, size);
+    Type *type = new_type(TY_STRUCT, size, true);
     type->members = members;
     return type;
 }
 
-// Create an enum type.
-Type *enum_type() { return new_type(TY_ENUM, 4); }
+// Return the enum type.
+Type *enum_type() { return &enum_ty; }
 
 // Decay the given node to an pointer when it is an array.
 Node *decay_array(Node *base) {
@@ -260,21 +293,43 @@ Node *decay_array(Node *base) {
     return node;
 }
 
-// Return true if the given two types are the same.
-bool is_same_type(Type *x, Type *y) {
-    if (x->kind != y->kind) {
-        return false;
-    }
-    switch (x->kind) {
+// Hash the structure of a type into h. `structs` is the stack of the struct types being hashed, and a struct type that
+// is reached again through a pointer is hashed by its depth on the stack.
+uint64_t do_hash_type(uint64_t h, Type *type, Vector *structs) {
+    h = hash64(h, &type->kind, sizeof(type->kind));
+    h = hash64(h, &type->size, sizeof(type->size));
+    switch (type->kind) {
         case TY_PTR:
-            return is_same_type(x->base, y->base);
+            return do_hash_type(h, type->base, structs);
         case TY_ARY:
-            return x->array_size == y->array_size && is_same_type(x->base, y->base);
+            h = hash64(h, &type->array_size, sizeof(type->array_size));
+            return do_hash_type(h, type->base, structs);
+        case TY_STRUCT:
+            for (int i = 0; i < structs->len; i++) {
+                if (vec_at(structs, i) == type) {
+                    return hash64(h, &i, sizeof(i));
+                }
+            }
+            vec_push(structs, type);
+            for (int i = 0; i < type->members->len; i++) {
+                Member *mem = vec_at(type->members->vals, i);
+                h = hash64(h, mem->name, strlen(mem->name) + 1);
+                h = hash64(h, &mem->offset, sizeof(mem->offset));
+                h = do_hash_type(h, mem->type, structs);
+            }
+            structs->len--;
+            return h;
         default:
-            return true;
+            return h;
     }
 }
 
+// Hash the structure of a type into h. Types of the same structure have the same hash in any compilation.
+uint64_t hash_type(uint64_t h, Type *type) { return do_hash_type(h, type, vec_create()); }
+
+// Return true if the given two types are the same.
+bool is_same_type(Type *x, Type *y) { return x == y; }
+
 // Ensure that the given node is referable.
 void ensure_referable(Node *node) {
     NodeKind kind = node->kind;
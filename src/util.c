@@ -1,12 +1,23 @@
 #include "10cc.h"
 
+// Return a string formatted with a va_list.
+char *vformat(char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+    int size = vsnprintf(NULL, 0, fmt, ap2) + 1;
+    va_end(ap2);
+
+    char *buff = malloc(size);
+    count_alloc(AK_FORMAT, size);
+    vsnprintf(buff, size, fmt, ap);
+    return buff;
+}
+
 // Return a formatted string.
 char *format(char *fmt, ...) {
-    size_t size = 2048;
-    char *buff = calloc(size, sizeof(char));
     va_list ap;
     va_start(ap, fmt);
-    vsnprintf(buff, sizeof(char) * size, fmt, ap);
+    char *buff = vformat(fmt, ap);
     va_end(ap);
     return buff;
 }
@@ -20,52 +31,96 @@ void debug(char *fmt, ...) {
     fprintf(stderr, "\n");
 }
 
+_Thread_local jmp_buf *bailout;  // Where a failed compilation on this thread resumes, or NULL to exit the process
+
+// Return the text of a diagnostic as it is shown to users.
+char *format_diagnostic(TenccDiagnostic *diag) {
+    char *msg = format("\033[31merror\033[m: %s\n", diag->message);
+    if (!diag->file) {
+        return msg;
+    }
+
+    // Show the line with a pointer to the location.
+    char *head = format("%s:%d: ", diag->file, diag->line);
+    int indent = strlen(head);
+    char *text = format("%s%.*s\n%*s^ %s", head, diag->text_len, diag->text, indent + diag->col - 1, "", msg);
+    free(head);
+    free(msg);
+    return text;
+}
+
+// Print a diagnostic to the standard error.
+void print_diagnostic(TenccDiagnostic *diag) {
+    char *text = format_diagnostic(diag);
+    fputs(text, stderr);
+    free(text);
+}
+
+// Abort the compilation running on this thread. It must have reported an error.
+void bail() { longjmp(*bailout, 1); }
+
+// Report an error. During a compilation, it is passed to the diagnostic handler of the compilation, which is aborted
+// afterward. Otherwise, it is printed, and the process exits unless the thread has set bailout.
+void report(TenccDiagnostic *diag) {
+    if (!bailout || !cc) {
+        print_diagnostic(diag);
+        if (!bailout) {
+            exit(1);
+        }
+        free(diag->message);
+        bail();
+    }
+    pthread_mutex_lock(&cc->diagnostic_lock);
+    if (!cc->failed && cc->on_diagnostic) {
+        cc->on_diagnostic(diag, cc->diagnostic_data);
+    }
+    cc->failed = true;
+    pthread_mutex_unlock(&cc->diagnostic_lock);
+    free(diag->message);
+    bail();
+}
+
 // Show an error message.
 void error(char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "\033[31merror\033[m: ");
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
-    exit(1);
+    TenccDiagnostic diag = {.message = vformat(fmt, ap)};
+    va_end(ap);
+    report(&diag);
 }
 
 // Show an error message with its location information.
 void error_at(char *loc, char *fmt, ...) {
-    // Find the start/end positions of the line.
-    char *line = loc;
-    while (user_input < line && line[-1] != '\n') {
-        line--;
+    // Find the file that contains loc.
+    File *file = cc->file;
+    for (int i = 0; cc->files && i < cc->files->len; i++) {
+        File *f = vec_at(cc->files, i);
+        if (f->contents <= loc && loc <= f->contents + f->size) {
+            file = f;
+            break;
+        }
     }
+
+    // Find the start/end positions of the line.
+    int line_idx = find_line(file, loc);
+    char *line = file->contents + file->lines[line_idx];
     char *end = loc;
     while (*end != '\n') {
         end++;
     }
 
-    // Investigate the line number.
-    int line_num = 1;
-    for (char *p = user_input; p < line; p++) {
-        if (*p == '\n') {
-            line_num++;
-        }
-    }
-
-    // Report the line number with the file name.
-    int indent = fprintf(stderr, "%s:%d: ", file_name, line_num);
-    fprintf(stderr, "%.*s\n", (int)(end - line), line);
-
-    // Display a pointer to the error location.
-    int pos = loc - line + indent;
-    fprintf(stderr, "%*s", pos, "");
-    fprintf(stderr, "^ ");
-
-    // Display an error message.
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "\033[31merror\033[m: ");
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
-    exit(1);
+    TenccDiagnostic diag = {
+        .file = file->name,
+        .line = line_idx + 1,
+        .col = loc - line + 1,
+        .text = line,
+        .text_len = end - line,
+        .message = vformat(fmt, ap),
+    };
+    va_end(ap);
+    report(&diag);
 }
 
 // Return true if the first string starts with the second string.
@@ -208,6 +263,7 @@ void draw_node(Node *node, int depth, char *role) {
             case ND_SIZEOF:
                 fprintf(stderr, "SIZEOF\n");
                 draw_node(node->lhs, depth + 1, "");
+                break;
             case ND_MEMBER:
                 fprintf(stderr, "MEMBER(name: %s)\n", node->member_name);
                 break;
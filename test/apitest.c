@@ -0,0 +1,225 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/tencc.h"
+
+int num_diagnostics;
+TenccDiagnostic last_diagnostic;  // Pointers in it are valid only during the handler
+char last_file[256];
+char last_text[256];
+char last_message[256];
+
+void check(bool ok, char *desc) {
+    if (ok) {
+        printf("\033[32m[PASSED]\033[m %s\n", desc);
+    } else {
+        printf("\033[31m[[FAILED]\033[m %s\n", desc);
+    }
+}
+
+void on_diagnostic(TenccDiagnostic *diag, void *data) {
+    num_diagnostics++;
+    last_diagnostic = *diag;
+    snprintf(last_file, sizeof(last_file), "%s", diag->file ? diag->file : "");
+    snprintf(last_text, sizeof(last_text), "%.*s", diag->text_len, diag->text);
+    snprintf(last_message, sizeof(last_message), "%s", diag->message);
+}
+
+char *cache_dir;    // Directory of the on-disk cache to compile with, or NULL
+int incremental;
+char *working_dir;  // Directory that relative paths are resolved against, or NULL
+char *emit_pch;     // Precompiled header to write, or NULL
+char *include_pch;  // Precompiled header to start from, or NULL
+int time_report;
+int mem_report;
+char *time_trace;
+
+// Compile a string, and return the assembly code or NULL.
+char *compile(char *src, int codegen_jobs) {
+    TenccOptions opts = {codegen_jobs, on_diagnostic, NULL, cache_dir, incremental, NULL, 0, working_dir,
+                         emit_pch, include_pch, time_report, mem_report, time_trace};
+    char *asm_code;
+    size_t asm_size;
+    num_diagnostics = 0;
+    if (tencc_compile("test.c", src, strlen(src), &opts, &asm_code, &asm_size)) {
+        return NULL;
+    }
+    return strlen(asm_code) == asm_size ? asm_code : NULL;
+}
+
+// Compile a string as compile() does, and store what the compilation prints to the standard error into buf, using a
+// file in dir.
+char *compile_with_stderr(char *src, int codegen_jobs, char *dir, char *buf, size_t size) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/stderr.txt", dir);
+    int saved = dup(2);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, 2);
+    close(fd);
+    char *asm_code = compile(src, codegen_jobs);
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+
+    FILE *fp = fopen(path, "r");
+    size_t n = fread(buf, 1, size - 1, fp);
+    buf[n] = '\0';
+    fclose(fp);
+    return asm_code;
+}
+
+// Write a file in a directory.
+void write_file(char *dir, char *name, char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+int main() {
+    char *funcs = "int f(int x) { while (x < 10) x++; return x; } int g() { return f(1) ? 2 : 3; } int main() { return g(); }";
+
+    char *a = compile("int main() { return 42; }", 1);
+    check(a && strstr(a, "main:") && num_diagnostics == 0, "compile a program");
+    char *b = compile("int main() { return 42; }", 1);
+    check(a && b && !strcmp(a, b), "compile the same program twice");
+    free(a);
+    free(b);
+
+    check(!compile("int main() {\n  return x;\n}", 1), "fail on an undefined variable");
+    check(num_diagnostics == 1, "report an error once");
+    check(!strcmp(last_file, "test.c") && last_diagnostic.line == 2 && last_diagnostic.col == 10 &&
+              !strcmp(last_text, "  return x;"),
+          "report the location of an error");
+    check(!strcmp(last_message, "'x' undeclared"), "report the message of an error");
+
+    a = compile(funcs, 1);
+    b = compile(funcs, 4);
+    check(a && b && !strcmp(a, b), "generate the same code with several threads");
+    free(a);
+    free(b);
+
+    check(!compile("int f() { return 1; } int main() { break; }", 4), "fail in a code generation thread");
+    check(num_diagnostics == 1, "report an error in a code generation thread once");
+    check(compile("int main() { return 0; }", 1) != NULL, "compile after errors");
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/apitest.%d", getpid());
+    mkdir(dir, 0755);
+    cache_dir = dir;
+    incremental = 1;
+    char *edited = "int f(int x) { while (x < 10) x++; return x; } int g() { return f(2) ? 2 : 3; } int main() { return g(); }";
+    a = compile(funcs, 1);
+    b = compile(edited, 1);
+    cache_dir = NULL;
+    char *c = compile(edited, 1);
+    check(a && b && c && !strcmp(b, c), "reuse the code of unchanged functions");
+    free(a);
+    free(b);
+    free(c);
+
+    working_dir = dir;
+    write_file(dir, "h.h", "int h() { return 1; }");
+    a = compile("#include \"h.h\"\nint main() { return h(); }", 1);
+    write_file(dir, "h.h", "int h() { return 22; }");
+    b = compile("#include \"h.h\"\nint main() { return h(); }", 1);
+    check(a && b && strstr(a, "push 1\n") && strstr(b, "push 22\n"), "read an included file again after it changes");
+    free(a);
+    free(b);
+
+    write_file(dir, "cond.h", "#if defined(ONE)\nint h() { return 11; }\n#else\nint h() { return 12; }\n#endif\n");
+    a = compile("#define ONE\n#include \"cond.h\"\nint main() { return h(); }", 1);
+    b = compile("#include \"cond.h\"\nint main() { return h(); }", 1);
+    c = compile("#define ONE\n#include \"cond.h\"\nint main() { return h(); }", 1);
+    check(a && b && c && strstr(a, "push 11\n") && strstr(b, "push 12\n") && !strcmp(a, c),
+          "take another branch of a cached header");
+    free(a);
+    free(b);
+    free(c);
+
+    write_file(dir, "pch.h", "#define SQUARE(x) ((x) * (x))\nstruct point { int x; int y; };\n"
+                             "typedef struct point point_t;\nenum { ORIGIN = 3 };\nint dist(point_t *p);\n");
+    emit_pch = "h.pch";
+    a = compile("#include \"pch.h\"\n", 1);
+    emit_pch = NULL;
+    char *src = "#include \"pch.h\"\nint main() { point_t p; p.y = ORIGIN; return SQUARE(p.y) + dist(&p); }";
+    b = compile(src, 1);
+    include_pch = "h.pch";
+    c = compile(src, 1);
+    check(a && !*a && b && c && !strcmp(b, c), "compile with a precompiled header as with the header");
+    free(a);
+    free(b);
+    free(c);
+
+    write_file(dir, "pch.h", "int dist();\n");
+    check(!compile(src, 1) && strstr(last_message, "has changed"), "reject a stale precompiled header");
+    include_pch = NULL;
+
+    char report[2048];
+    time_report = 1;
+    a = compile_with_stderr(funcs, 4, dir, report, sizeof(report));
+    time_report = 0;
+    check(a && strstr(report, "time report for test.c:") && strstr(report, "\n  codegen ") &&
+              strstr(report, "\n  functions             3\n"),
+          "report the time of each phase");
+    free(a);
+
+    mem_report = 1;
+    a = compile_with_stderr(funcs, 1, dir, report, sizeof(report));
+    mem_report = 0;
+    char funcs_line[64];
+    snprintf(funcs_line, sizeof(funcs_line), "\n  %-12s %10d ", "func", 3);
+    check(a && strstr(report, "memory report for test.c:") && strstr(report, funcs_line) &&
+              strstr(report, "\n  peak RSS (process) "),
+          "report the allocations of each kind");
+    free(a);
+
+    mem_report = 1;
+    a = compile_with_stderr("int fresh_identifier() { return 0; }", 1, dir, report, sizeof(report));
+    mem_report = 0;
+    char *ident_line = strstr(report, "\n  ident ");
+    char *source_line = strstr(report, "\n  source ");
+    check(ident_line && atol(ident_line + 15) > 0 && source_line && atol(source_line + 15) > 0,
+          "count interned identifiers and source files");
+    free(a);
+
+    time_trace = "trace.json";
+    a = compile(funcs, 4);
+    time_trace = NULL;
+    char trace_path[256];
+    snprintf(trace_path, sizeof(trace_path), "%s/trace.json", dir);
+    char trace[8192] = "";
+    FILE *fp = fopen(trace_path, "r");
+    if (fp) {
+        fread(trace, 1, sizeof(trace) - 1, fp);
+        fclose(fp);
+    }
+    check(a && !strncmp(trace, "{\"displayTimeUnit\"", 18) && strstr(trace, "{\"name\":\"parse\",\"cat\":\"phase\"") &&
+              strstr(trace, "{\"name\":\"f\",\"cat\":\"parse\"") &&
+              strstr(trace, "{\"name\":\"g\",\"cat\":\"sema\"") &&
+              strstr(trace, "{\"name\":\"main\",\"cat\":\"codegen\"") && strstr(trace, "\n]}\n"),
+          "write a trace of the phases and the functions");
+    free(a);
+
+    // The command line goes on with the other inputs when an input cannot be read.
+    write_file(dir, "ok.c", "int main() { return 0; }");
+    char cwd[256], cli[768], ok_path[256];
+    getcwd(cwd, sizeof(cwd));
+    snprintf(cli, sizeof(cli), "cd %s && %s/bld/10cc -j1 missing.c ok.c 2> stderr.txt", dir, cwd);
+    int status = system(cli);
+    snprintf(ok_path, sizeof(ok_path), "%s/ok.s", dir);
+    struct stat st;
+    check(status != 0 && stat(ok_path, &st) == 0 && st.st_size > 0,
+          "compile the other inputs when an input cannot be read");
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    return 0;
+}
@@ -0,0 +1,7 @@
+// An include guard
+#ifndef GUARDED_H
+#define GUARDED_H
+
+int guarded() { return 5; }
+
+#endif
@@ -0,0 +1,13 @@
+// Platform-conditional blocks inside an include guard
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#if defined(PLATFORM_A)
+int platform() { return 1; }
+#elif defined(PLATFORM_B) && PLATFORM_B > 1
+int platform() { return PLATFORM_B; }
+#else
+int platform() { return 3; }
+#endif
+
+#endif
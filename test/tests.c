@@ -1,6 +1,48 @@
 // null directive
 #
 
+// Each header is included only once.
+#include "include/guarded.h"
+#include <guarded.h>
+#include "include/once.h"
+#include <once.h>
+
+// Macros.
+#define M_ONE 1
+#define M_ADD(a, b) ((a) + (b))
+#define M_TWICE(x) M_ADD(x, x)
+#define M_STR(x) #x
+#define M_CAT(a, b) a##b
+#define M_SELF M_SELF
+#define M_NOARGS() 7
+#define M_TMP 3
+#undef M_TMP
+#define M_TMP 4
+
+int M_CAT(m_, var);
+
+// Conditional inclusion.
+#define PLATFORM_B 2
+#include "include/platform.h"
+#include "include/platform.h"
+
+#if M_ONE + 1 == 2 && defined(M_ADD) && !defined M_UNDEFINED
+int cond_if() { return 1; }
+#elif 1 / 0
+#else
+int cond_if() { return 2; }
+#endif
+
+#ifdef M_UNDEFINED
+#error not reached
+#elif M_ONE
+#ifndef M_ONE
+#error not reached
+#else
+int cond_nested() { return 3; }
+#endif
+#endif
+
 // A line comment.
 
 /**
@@ -39,6 +81,26 @@ int fibo(int n) {
     }
 }
 
+int while_break() {
+    int i = 0;
+    while (1) {
+        i++;
+        if (i == 3) break;
+    }
+    return i;
+}
+
+int while_continue(int n) {
+    int i = 0;
+    int total = 0;
+    while (i < n) {
+        i++;
+        if (i == 3) continue;
+        total = total + i;
+    }
+    return total;
+}
+
 char first(char *str) {
     return str[0];
 }
@@ -233,5 +295,30 @@ int main() {
     assert(1, ~-2, "~-2;");
     assert(0, ~-1, "~-1;");
     assert(-1, ~0, "~0;");
+    assert(1, ({ int x = 1; { int x = 2; } x; }), "int x = 1; { int x = 2; } x;");
+    assert(2, ({ int x = 1; int y; { int x = 2; y = x; } y; }), "int x = 1; int y; { int x = 2; y = x; } y;");
+    assert(8, ({ typedef int T; int n; { typedef long T; T y; n = sizeof(y); } n; }), "typedef int T; int n; { typedef long T; T y; n = sizeof(y); } n;");
+    assert(4, ({ typedef int T; { typedef long T; } T y; sizeof(y); }), "typedef int T; { typedef long T; } T y; sizeof(y);");
+    assert(1, ({ struct S {char a;}; { struct S {long a;}; } struct S s; sizeof(s); }), "struct S {char a;}; { struct S {long a;}; } struct S s; sizeof(s);");
+    assert(3, ({ int_gvar = 3; { int int_gvar = 4; } int_gvar; }), "int_gvar = 3; { int int_gvar = 4; } int_gvar;");
+    assert(12, ({ typedef int A[]; A x = {1, 2}; A y = {1, 2, 3}; sizeof(y); }), "typedef int A[]; A x = {1, 2}; A y = {1, 2, 3}; sizeof(y);");
+    assert(1, ({ int *p; int *q; int a; p = &a; q = p; 1 ? p : q; 1; }), "int *p; int *q; int a; p = &a; q = p; 1 ? p : q; 1;");
+    assert(3, while_break(), "while_break();");
+    assert(52, while_continue(10), "while_continue(10);");
+    assert(5, guarded(), "guarded();");
+    assert(6, once(), "once();");
+    assert(1, M_ONE, "M_ONE");
+    assert(5, M_ADD(2, 3), "M_ADD(2, 3)");
+    assert(8, M_TWICE(M_ADD(M_ONE, 3)), "M_TWICE(M_ADD(M_ONE, 3))");
+    assert(4, sizeof(M_STR(a+b)), "sizeof(M_STR(a+b))");
+    assert(43, M_STR(a + b)[2], "M_STR(a + b)[2]");
+    assert(9, ({ m_var = 9; m_var; }), "m_var = 9; m_var;");
+    assert(12, M_CAT(1, 2), "M_CAT(1, 2)");
+    assert(3, ({ int M_SELF = 3; M_SELF; }), "int M_SELF = 3; M_SELF;");
+    assert(7, M_NOARGS(), "M_NOARGS()");
+    assert(4, M_TMP, "M_TMP");
+    assert(2, platform(), "platform();");
+    assert(1, cond_if(), "cond_if();");
+    assert(3, cond_nested(), "cond_nested();");
     return 0;
 }